@@ -10,7 +10,15 @@
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
 #else
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -34,6 +42,40 @@ enum {
   
   // One million(ish) bytes
   MEGABYTE = 1024*1024,
+
+  // Weight on cost to go to start anytime search with, unless the
+  // user asks for a bigger one
+  ANYTIME_WEIGHT = 5,
+
+  // Most weights an anytime search will record statistics for
+  MAX_ROUNDS = 32,
+
+  // How many partial paths path enumeration may visit for each free
+  // cell before the exact cover engine gives up on it
+  DLX_STEPS_PER_CELL = 10,
+
+  // Slots in the nogood store (must be a power of 2), and how far to
+  // probe for a signature before giving up
+  NOGOOD_STORE_SIZE = 1 << 16,
+  NOGOOD_MAX_PROBES = 16,
+
+  // Slots in the solution cache file, and how far to probe for a
+  // puzzle before giving up
+  CACHE_SLOTS = 1 << 14,
+  CACHE_MAX_PROBES = 16,
+
+  // Most options in a --serve request, counting the program name
+  // that goes in front of them like on the command line
+  MAX_SERVE_OPTIONS = 64,
+
+  // Subproblems for each thread to take turns on when counting
+  // solutions with the constraint propagation engine
+  CP_SUBPROBLEMS_PER_THREAD = 16,
+
+  // Segment ids in a frontier fit in a 32-bit mask; new segments get
+  // the last one until the frontier is normalized
+  FRONTIER_MAX_IDS = 32,
+  FRONTIER_NEW_ID = FRONTIER_MAX_IDS-1,
   
 };
 
@@ -62,6 +104,65 @@ enum {
   SEARCH_IN_PROGRESS = 3,
 };
 
+// Node checks, used to index pruning statistics
+enum {
+  CHECK_DEADENDS = 0,
+  CHECK_STRANDED = 1,
+  CHECK_MATCHING = 2,
+  CHECK_PARITY = 3,
+  CHECK_DISTANCE = 4,
+  CHECK_DOMAINS = 5,
+  CHECK_BOTTLENECK = 6,
+  NUM_CHECKS = 7
+};
+
+// Classes of cells used to index local pattern tables
+enum {
+  PATTERN_BLOCKED = 0, // Off the board, or path of any color
+  PATTERN_FREE = 1,    // Free space
+  PATTERN_CUR = 2,     // Current position of an active color
+  PATTERN_GOAL = 3     // Goal position of an active color
+};
+
+// Results of looking up a free cell's neighbors in the pattern table
+enum {
+  CELL_OK = 0,
+  CELL_DEADEND = 1,    // Can't get a path into and out of it
+  CELL_SQUEEZED = 2    // No free neighbors, needs a neighboring current
+                       // and goal position of the same color
+};
+
+// Heuristics for estimating cost to go (dist and regions overestimate)
+enum {
+  HEURISTIC_FREE = 0,    // Number of free cells
+  HEURISTIC_DIST = 1,    // Plus shortest remaining path for each color
+  HEURISTIC_REGIONS = 2, // Plus colors competing for each region
+  NUM_HEURISTICS = 3
+};
+
+// Ways to solve a puzzle
+enum {
+  ENGINE_SEARCH = 0, // Best-first or breadth-first search
+  ENGINE_SAT = 1,    // Reduction to SAT (see game_search_sat)
+  ENGINE_DLX = 2,    // Exact cover of paths (see game_search_dlx)
+  ENGINE_FRONTIER = 3, // Frontier DP (see game_search_frontier)
+  ENGINE_CP = 4,     // Constraint propagation (see game_search_cp)
+  NUM_ENGINES = 5
+};
+
+// SAT encoding and solver parameters
+enum {
+  SAT_NUM_DIR_TYPES = 6,      // Ways a path can pass through a cell
+  SAT_RESTART_CONFLICTS = 100 // Conflicts per unit of Luby sequence
+};
+
+// Which groups of node checks to run (see game_check_state)
+enum {
+  CHECKS_CHEAP = 1,     // Local checks around the last move
+  CHECKS_EXPENSIVE = 2, // Checks that analyze the whole board
+  CHECKS_ALL = 3
+};
+
 // Represent the contents of a cell on the game board
 typedef uint8_t cell_t;
 
@@ -90,19 +191,43 @@ typedef struct options_struct {
   int    node_check_touch;
   int    node_check_stranded;
   int    node_check_deadends;
+  int    node_check_matching;
+  int    node_check_parity;
+  int    node_check_distance;
+  int    node_check_domains;
   int    node_bottleneck_limit;
   int    node_penalize_exploration;
+  int    node_lazy_checks;
   
   int    order_autosort_colors;
   int    order_most_constrained;
   int    order_forced_first;
   int    order_random;
+  unsigned order_seed;
   
   int    search_best_first;
   int    search_outside_in;
   size_t search_max_nodes;
   double search_max_mb;
   int    search_fast_forward;
+  int    search_partial_expansion;
+  int    search_corridors;
+  int    search_split;
+  int    search_both_ends;
+  int    search_threads;
+  int    search_nogoods;
+  int    search_symmetry;
+  int    search_heuristic;
+  int    search_engine;
+  size_t search_max_paths;
+  double search_weight;
+  int    search_anytime;
+  size_t search_restart_unit;
+  int    search_count;
+  const char* cache_file;
+  
+  int    serve;
+  const char* serve_socket;
   
 } options_t;
 
@@ -116,6 +241,9 @@ typedef struct game_info_struct {
   // Color order
   int    color_order[MAX_COLORS];
 
+  // Order to try moves in when expanding a node
+  int    dir_order[4];
+
   // Initial and goal positions
   pos_t  init_pos[MAX_COLORS];
   pos_t  goal_pos[MAX_COLORS];
@@ -131,6 +259,11 @@ typedef struct game_info_struct {
 
   // Was user order specified?
   int user_order;
+
+  // Symmetries of the board (see sym_coords) that map the endpoints
+  // onto each other, color by color
+  int    symmetries[7];
+  size_t num_symmetries;
   
 } game_info_t;
 
@@ -146,6 +279,10 @@ typedef struct game_state_struct {
   // Head position
   pos_t    pos[MAX_COLORS];
 
+  // Tail position: starts at the goal, but can grow too (see
+  // game_swap_ends)
+  pos_t    tail[MAX_COLORS];
+
   // How many free cells?
   uint8_t  num_free;
 
@@ -158,6 +295,20 @@ typedef struct game_state_struct {
   
 } game_state_t;
 
+// Soft hints, combined from one or more hint boards: the extra cost
+// of moving each color into each cell, adding up the weights of the
+// boards that put another color there
+typedef struct hint_struct {
+  float penalty[MAX_CELLS][MAX_COLORS];
+} hint_t;
+
+// Hint board from the command line, for one of the input files
+typedef struct hint_file_struct {
+  const char* filename;
+  double      weight;
+  size_t      input;
+} hint_file_t;
+
 // Used for auto-sorting colors
 typedef struct color_features_struct {
   int index;
@@ -175,9 +326,42 @@ typedef struct region_struct {
   uint8_t rank;
 } region_t;
 
+// Progress of an anytime search, recorded when it is done with each
+// weight.
+typedef struct search_round_struct {
+  double weight;  // Weight on cost to go
+  double cost;    // Cost of best solution so far (HUGE_VAL if none)
+  double elapsed; // Seconds since the search started
+  size_t nodes;   // Nodes used since the search started
+} search_round_t;
+
+// Statistics accumulated over a search.
+typedef struct search_stats_struct {
+  double check_time[NUM_CHECKS]; // Seconds spent running each check
+  size_t pruned[NUM_CHECKS];     // Nodes pruned by each check
+  size_t requeued;               // Nodes re-queued by partial expansion
+  size_t splits;                 // States split into subproblems
+  size_t subsearch_nodes;        // Nodes used by searches of those
+  size_t restarts;               // Searches abandoned by restarting
+  size_t nogoods_stored;         // Unsolvable subproblems remembered
+  size_t nogoods_pruned;         // States pruned by remembering them
+  size_t symmetric_pruned;       // Moves skipped as mirrors of others
+  size_t num_rounds;             // Weights tried by anytime search
+  search_round_t rounds[MAX_ROUNDS];
+  size_t solutions;              // Solutions found when counting
+  int solutions_exact;           // Are there no more than that?
+} search_stats_t;
+
+// Set of board positions, one bit per pos_t, for bit-parallel
+// operations over the whole board. Each word holds four rows.
+typedef struct bitboard_struct {
+  uint64_t words[4];
+} bitboard_t;
+
 // Search node for A* / BFS.
 typedef struct tree_node_struct {
   game_state_t state;              // Current game state
+  uint8_t expansions;              // Times partially expanded so far
   double cost_to_come;             // Cost to come (ignored for BFS)
   double cost_to_go;               // Heuristic cost (ignored for BFS)
   struct tree_node_struct* parent; // Parent of this node (may be NULL)
@@ -196,6 +380,7 @@ typedef struct heapq_struct {
   tree_node_t** start; // Array of node pointers
   size_t capacity;     // Maximum allowable queue size
   size_t count;        // Number enqueued
+  double weight;       // Weight on cost to go (1 for plain A*)
 } heapq_t;
 
 // First in, first-out queue implemented as an array of pointers.
@@ -212,11 +397,162 @@ typedef union queue_union {
   fifo_t  fifo;
 } queue_t;
 
+// Growable array of ints, used by the SAT solver.
+typedef struct sat_vec_struct {
+  int* data;
+  size_t count;
+  size_t capacity;
+} sat_vec_t;
+
+// Conflict-driven clause learning SAT solver (see sat_ functions).
+// Variables are numbered from 0; literal 2*v means v is true and
+// literal 2*v+1 means v is false.
+typedef struct sat_solver_struct {
+  size_t num_vars;
+  sat_vec_t clauses;    // Each clause is its size, then its literals
+  sat_vec_t* watches;   // Clauses watching each literal become false
+  int8_t* value;        // 1 if variable true, -1 if false, 0 if unset
+  int8_t* phase;        // Last value of each variable, for decisions
+  int* level;           // Decision level each variable was set at
+  int* reason;          // Clause that implied each variable, or -1
+  double* activity;     // How often each variable shows up in conflicts
+  double var_inc;       // How much to bump activity by
+  int* heap;            // Unset variables, most active first
+  int* heap_index;      // Index of each variable in heap, or -1
+  size_t heap_count;
+  int* trail;           // Literals set, in order
+  size_t trail_count;
+  size_t qhead;         // Next literal on trail to propagate
+  sat_vec_t trail_lim;  // Trail size at start of each decision level
+  uint8_t* seen;        // Scratch flags for conflict analysis
+  int ok;               // Cleared once the clauses are unsatisfiable
+  size_t decisions;
+  size_t conflicts;
+} sat_solver_t;
+
+// Candidate paths for the exact cover engine. The cells of path i
+// (not counting its endpoints) are cells[start[i]] up to
+// cells[start[i+1]].
+typedef struct path_set_struct {
+  size_t* start;
+  uint8_t* color;
+  pos_t* cells;
+  size_t count;
+  size_t capacity;
+  size_t cells_capacity;
+  size_t max_paths;  // Stop enumerating after this many paths
+  size_t steps;      // Partial paths visited so far
+  size_t max_steps;  // Stop enumerating after this many
+} path_set_t;
+
+// Sparse exact cover matrix for Knuth's dancing links. Nodes
+// 1..num_columns are column headers, and node 0 heads the list of
+// columns left to cover.
+typedef struct dlx_struct {
+  int* left;
+  int* right;
+  int* up;
+  int* down;
+  int* column;               // Column header of each node
+  int* row;                  // Path index of each node
+  int* size;                 // Rows left in each column
+  int* chosen;               // Rows in the solution
+  size_t num_chosen;
+  size_t rows_tried;
+  int cell_column[MAX_CELLS]; // Column for each free cell
+} dlx_t;
+
+// What the frontier DP remembers about the cells decided so far.
+// After deciding cell (x, y), columns up to x hold row y and the
+// rest hold row y-1. Loose path ends are labeled by segment, so that
+// joining two ends of the same segment (a cycle) can be ruled out.
+typedef struct frontier_struct {
+  uint8_t color[MAX_SIZE]; // Color of the last decided cell in each column
+  uint8_t id[MAX_SIZE];    // Segment leaving that cell downwards, or 0
+  uint8_t right_id;        // Segment leaving the last cell rightwards, or 0
+  uint16_t done;           // Colors whose endpoints are joined
+  uint32_t attached;       // Segments with one end at an endpoint
+} frontier_t;
+
+// One layer of distinct frontiers, with how many ways each one can
+// be reached and the move that first reached it
+typedef struct frontier_layer_struct {
+  frontier_t* states;
+  uint64_t* counts;
+  uint32_t* parents;     // Index of the parent frontier in the last layer
+  uint8_t* moves;        // See frontier_children
+  size_t count;
+  size_t capacity;
+  uint32_t* table;       // Hash table of state indices plus 1, 0 if empty
+  size_t table_size;
+} frontier_layer_t;
+
+// Domains for the constraint propagation engine. A cell's shapes are
+// the direction masks it may connect by (bit m set if it may connect
+// to exactly the neighbors in mask m), and its colors the colors it
+// may have.
+typedef struct cp_domains_struct {
+  uint16_t shapes[MAX_CELLS];
+  uint16_t colors[MAX_CELLS];
+} cp_domains_t;
+
+// Header of the solution cache file, followed by CACHE_SLOTS slots
+typedef struct cache_header_struct {
+  char magic[8];
+  uint32_t num_slots;
+  uint32_t slot_size;
+} cache_header_t;
+
+// Solution of one puzzle in the cache, in canonical form (see
+// game_canonicalize): the links (see game_state_from_links) of each
+// cell of the canonical board, row by row, with colors relabeled.
+typedef struct cache_slot_struct {
+  uint64_t key;                       // Hash of canonical form, 0 if empty
+  uint8_t size;
+  uint8_t links[MAX_SIZE*MAX_SIZE];
+} cache_slot_t;
+
+// Memory-mapped solution cache file
+typedef struct solution_cache_struct {
+  cache_header_t* header;
+  cache_slot_t* slots;
+  size_t bytes;
+} solution_cache_t;
+
+// A puzzle request read by --serve (see serve_parse_request).
+typedef struct serve_request_struct {
+  char id[256];                   // JSON text of the id to echo back
+  char board[1024];               // Rows of the board, one per line
+  char options[1024];             // Option strings, back to back
+  char* argv[MAX_SERVE_OPTIONS];  // Options to parse, after argv[0]
+  int argc;
+} serve_request_t;
+
+// One depth-first search of the constraint propagation engine. When
+// counting solutions, several of these run in threads, sharing the
+// totals and a list of subproblems.
+typedef struct cp_search_struct {
+  const game_info_t* info;
+  const game_state_t* init_state;
+  cp_domains_t solution;      // First solution this search found
+  size_t solutions;           // Solutions this search found
+  size_t branches;            // Branches this search took
+  size_t max_solutions;       // Stop once the total gets here
+  size_t* total_solutions;    // Shared by all searches
+  size_t* total_branches;     // Shared by all searches
+  cp_domains_t* subproblems;  // Shared by all searches
+  size_t num_subproblems;
+  size_t* next_subproblem;    // Index of next one to search
+  search_stats_t stats;
+  int result;
+} cp_search_t;
+
 // Function pointers for either type of queue
 queue_t (*queue_create)(size_t) = 0;
 void (*queue_enqueue)(queue_t*, tree_node_t*) = 0;
 tree_node_t* (*queue_deque)(queue_t*) = 0;
 void (*queue_destroy)(queue_t*) = 0;
+void (*queue_clear)(queue_t*) = 0;
 int (*queue_empty)(const queue_t*) = 0;
 const tree_node_t* (*queue_peek)(const queue_t*) = 0;
 
@@ -233,6 +569,58 @@ const char* SEARCH_RESULT_STRINGS[4] = {
   "in progress"
 };
 
+// For parsing and printing engine names
+const char* ENGINE_STRINGS[NUM_ENGINES] = {
+  "search",
+  "sat",
+  "dlx",
+  "frontier",
+  "cp"
+};
+
+// For parsing and printing heuristic names
+const char* HEURISTIC_STRINGS[NUM_HEURISTICS] = {
+  "free",
+  "dist",
+  "regions"
+};
+
+// For printing pruning statistics
+const char* CHECK_STRINGS[NUM_CHECKS] = {
+  "dead-end",
+  "stranded",
+  "matching",
+  "parity",
+  "distance",
+  "domain",
+  "bottleneck"
+};
+
+// Shapes (see cp_domains_t) that connect in each direction.
+const uint16_t CP_SHAPES_WITH_DIR[4] = {
+  0xaaaa, // masks with bit 0 set
+  0xcccc, // bit 1
+  0xf0f0, // bit 2
+  0xff00  // bit 3
+};
+
+// Identifies solution cache files (and their format version)
+const char CACHE_MAGIC[8] = "flowsol1";
+
+// Pairs of directions a path can take through a cell, for SAT.
+const uint8_t SAT_DIR_TYPES[SAT_NUM_DIR_TYPES] = {
+  (1 << DIR_LEFT) | (1 << DIR_RIGHT),
+  (1 << DIR_UP)   | (1 << DIR_DOWN),
+  (1 << DIR_UP)   | (1 << DIR_LEFT),
+  (1 << DIR_UP)   | (1 << DIR_RIGHT),
+  (1 << DIR_DOWN) | (1 << DIR_LEFT),
+  (1 << DIR_DOWN) | (1 << DIR_RIGHT)
+};
+
+// Variable activities in the SAT solver decay by this much per
+// conflict.
+const double SAT_ACTIVITY_DECAY = 0.95;
+
 // Was gonna try some unicode magic but meh
 const char* BLOCK_CHAR = "#";
 
@@ -271,6 +659,25 @@ const color_lookup_t color_dict[MAX_COLORS] = {
 // Global options struct gets setup during main
 options_t g_options;
 
+// Local pattern tables get setup during main by patterns_setup.
+// Cell patterns are indexed by the classes of a free cell's four
+// neighbors, and block patterns by the classes of the eight cells
+// around a 2x2 block of free cells, 2 bits each.
+uint8_t g_cell_patterns[1 << 8];
+uint8_t g_block_patterns[1 << 16];
+
+// Nogood store: open-addressed hash set of signatures of subproblems
+// found to be unsolvable (see game_nogood_ functions), cleared before
+// each search. Zero marks an empty slot. Sub-searches running in
+// other threads share it, so slots are only accessed atomically.
+uint64_t g_nogoods[NOGOOD_STORE_SIZE];
+
+// Node storage and queue array kept from one search to the next (see
+// search_memory_get), so a batch of puzzles or a --serve session only
+// allocates them once.
+node_storage_t g_search_storage;
+tree_node_t** g_search_queue;
+
 //////////////////////////////////////////////////////////////////////
 // Return the current time as a double. Don't actually care what zero
 // is cause we will just offset.
@@ -456,6 +863,65 @@ int pos_get_wall_dist(const game_info_t* info,
 
 }
 
+//////////////////////////////////////////////////////////////////////
+// Map x, y coordinates through one of the 8 symmetries of a square
+// board: transpose if bit 2 is set, then flip x for bit 0 and y for
+// bit 1.
+
+void sym_coords(size_t size, int sym, int x, int y, int* sx, int* sy) {
+
+  if (sym & 4) { int tmp = x; x = y; y = tmp; }
+  if (sym & 1) { x = size - 1 - x; }
+  if (sym & 2) { y = size - 1 - y; }
+
+  *sx = x;
+  *sy = y;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Map a set of direction flags through a symmetry (see sym_coords)
+
+uint8_t sym_dir_flags(int sym, uint8_t flags) {
+
+  uint8_t result = 0;
+
+  for (int dir=0; dir<4; ++dir) {
+
+    if (!(flags & (1 << dir))) { continue; }
+
+    int dx = DIR_DELTA[dir][0], dy = DIR_DELTA[dir][1];
+
+    if (sym & 4) { int tmp = dx; dx = dy; dy = tmp; }
+    if (sym & 1) { dx = -dx; }
+    if (sym & 2) { dy = -dy; }
+
+    for (int sdir=0; sdir<4; ++sdir) {
+      if (DIR_DELTA[sdir][0] == dx && DIR_DELTA[sdir][1] == dy) {
+        result |= (1 << sdir);
+      }
+    }
+
+  }
+
+  return result;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Map a position through a symmetry (see sym_coords)
+
+pos_t pos_symmetric(const game_info_t* info, int sym, pos_t pos) {
+
+  int x, y, sx, sy;
+
+  pos_get_coords(pos, &x, &y);
+  sym_coords(info->size, sym, x, y, &sx, &sy);
+
+  return pos_from_coords(sx, sy);
+
+}
+
 //////////////////////////////////////////////////////////////////////
 // Create a cell from a 2-bit type, a 4-bit color, and a 2-bit
 // direction.
@@ -485,6 +951,55 @@ uint8_t cell_get_color(cell_t c) {
   return (c >> 4) & 0xf;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Add a position to a bitboard
+
+void bitboard_set(bitboard_t* b, pos_t pos) {
+  b->words[pos >> 6] |= (uint64_t)1 << (pos & 63);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Is the position in the bitboard?
+
+int bitboard_test(const bitboard_t* b, pos_t pos) {
+  return (b->words[pos >> 6] >> (pos & 63)) & 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Is the bitboard empty?
+
+int bitboard_empty(const bitboard_t* b) {
+  return !(b->words[0] | b->words[1] | b->words[2] | b->words[3]);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Grow a set of positions by one step in every cardinal direction.
+// Steps off the left or right edge land in the unused column or off
+// the board, so the caller must mask the result (e.g. with free
+// space) before using it.
+
+bitboard_t bitboard_dilate(const bitboard_t* b) {
+
+  bitboard_t rval;
+
+  for (int i=0; i<4; ++i) {
+
+    uint64_t w = b->words[i];
+    uint64_t prev = i ? b->words[i-1] : 0;
+    uint64_t next = i < 3 ? b->words[i+1] : 0;
+
+    rval.words[i] = ( w |
+                      (w << 1)  | (prev >> 63) |   // right
+                      (w >> 1)  | (next << 63) |   // left
+                      (w << 16) | (prev >> 48) |   // down
+                      (w >> 16) | (next << 48) );  // up
+    
+  }
+
+  return rval;
+
+}
+
 //////////////////////////////////////////////////////////////////////
 // For displaying a color nicely
 
@@ -556,7 +1071,7 @@ int game_can_move(const game_info_t* info,
   assert( new_pos < MAX_CELLS );
 
   if (!g_options.node_check_touch &&
-      new_pos == info->goal_pos[color]) {
+      new_pos == state->tail[color]) {
     return 1;
   }
 
@@ -581,7 +1096,7 @@ int game_can_move(const game_info_t* info,
       if (neighbor_pos != INVALID_POS && 
           state->cells[neighbor_pos] &&
           neighbor_pos != state->pos[color] && 
-          neighbor_pos != info->goal_pos[color] && 
+          neighbor_pos != state->tail[color] && 
           cell_get_color(state->cells[neighbor_pos]) == color) {
         return 0;
       }
@@ -668,12 +1183,21 @@ void game_print_svg(FILE* fp,
     }
   }
 
-  for (int color=0; color<info->num_colors; ++color) {
+  for (int i=0; i<2*info->num_colors; ++i) {
+
+    // Completed paths run from goal to init, but unfinished ones can
+    // have a chain growing from each end.
+    int color = i / 2;
+    int completed = state->completed & (1 << color);
 
-    pos_t pos = (state->completed & (1 << color)) ?
-      info->goal_pos[color] : state->pos[color];
+    if (completed && (i & 1)) { continue; }
 
-    if (pos == info->init_pos[color]) { continue; }
+    pos_t pos = completed ? info->goal_pos[color] :
+      (i & 1) ? state->tail[color] : state->pos[color];
+
+    if (!completed && cell_get_type(state->cells[pos]) != TYPE_PATH) {
+      continue;
+    }
 
     int x, y;
     pos_get_coords(pos, &x, &y);
@@ -702,7 +1226,7 @@ void game_print_svg(FILE* fp,
 
       pos = npos;
 
-      if (pos == info->init_pos[color]) {
+      if (cell_get_type(state->cells[pos]) != TYPE_PATH) {
         break;
       }
 
@@ -798,6 +1322,72 @@ int game_num_free_pos(const game_info_t* info,
 
 }
 
+//////////////////////////////////////////////////////////////////////
+// Swap the head and tail of a color, so that the next move grows its
+// path from the other end.
+
+void game_swap_ends(game_state_t* state, int color) {
+
+  pos_t tmp = state->pos[color];
+  state->pos[color] = state->tail[color];
+  state->tail[color] = tmp;
+  
+}
+
+//////////////////////////////////////////////////////////////////////
+// Helper function for below -- path cells point back along the chain
+// they grew from, so follow them to the init or goal position where
+// the chain starts.
+
+pos_t game_chain_start(const game_info_t* info,
+                       const game_state_t* state,
+                       pos_t pos) {
+
+  while (cell_get_type(state->cells[pos]) == TYPE_PATH) {
+    pos = pos_offset_pos(info, pos, cell_get_direction(state->cells[pos]) ^ 1);
+  }
+
+  return pos;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Helper function for below -- when the end at from reaches the end
+// at to by going in direction dir, join the chains grown from the
+// init and goal positions by reversing the cells on the goal side, so
+// the whole path points back towards init.
+
+void game_join_ends(const game_info_t* info,
+                    game_state_t* state,
+                    int color,
+                    pos_t from, pos_t to, int dir) {
+
+  if (game_chain_start(info, state, from) == info->goal_pos[color]) {
+    pos_t tmp = from;
+    from = to;
+    to = tmp;
+    dir ^= 1;
+  }
+
+  pos_t pos = to;
+
+  while (1) {
+    
+    cell_t cell = state->cells[pos];
+    int type = cell_get_type(cell);
+    int old_dir = cell_get_direction(cell);
+    
+    state->cells[pos] = cell_create(type, color, dir);
+    
+    if (type != TYPE_PATH) { break; }
+
+    dir = old_dir ^ 1;
+    pos = pos_offset_pos(info, pos, dir);
+    
+  }
+
+}
+
 //////////////////////////////////////////////////////////////////////
 // Update the game state to make the given move.
 
@@ -828,8 +1418,8 @@ double game_make_move(const game_info_t* info,
   pos_t new_pos = pos_from_coords(new_x, new_y);
   assert( new_pos < MAX_CELLS );
 
-  if (!g_options.node_check_touch && new_pos == info->goal_pos[color]) {
-    state->cells[info->goal_pos[color]] = cell_create(TYPE_GOAL, color, dir);
+  if (!g_options.node_check_touch && new_pos == state->tail[color]) {
+    game_join_ends(info, state, color, state->pos[color], new_pos, dir);
     state->completed |= 1 << color;
     return 0;
   }
@@ -850,7 +1440,7 @@ double game_make_move(const game_info_t* info,
 
   if (g_options.node_check_touch) {
     for (int dir=0; dir<4; ++dir) {
-      if (offset_pos(info, new_x, new_y, dir) == info->goal_pos[color]) {
+      if (offset_pos(info, new_x, new_y, dir) == state->tail[color]) {
         goal_dir = dir;
         break;
       }
@@ -859,7 +1449,7 @@ double game_make_move(const game_info_t* info,
 
   if (goal_dir >= 0) {
 
-    state->cells[info->goal_pos[color]] = cell_create(TYPE_GOAL, color, goal_dir);
+    game_join_ends(info, state, color, new_pos, state->tail[color], goal_dir);
     state->completed |= (1 << color);
     action_cost = 0;
     
@@ -903,19 +1493,55 @@ int detect_format(FILE* fp) {
 }
 
 //////////////////////////////////////////////////////////////////////
-// Read game board from text file
+// Find the symmetries of a freshly read board: the rotations and
+// reflections that take the two endpoints of each color to the two
+// endpoints of some color (possibly a different one). Searches use
+// these to skip moves that mirror ones they already tried.
 
-int game_read(const char* filename,
-              game_info_t* info,
-              game_state_t* state) {
+void game_find_symmetries(game_info_t* info) {
 
-  FILE* fp = fopen(filename, "r");
+  info->num_symmetries = 0;
+
+  for (int sym=1; sym<8; ++sym) {
+
+    int matches = 1;
+
+    for (size_t color=0; color<info->num_colors && matches; ++color) {
+
+      pos_t init_pos = pos_symmetric(info, sym, info->init_pos[color]);
+      pos_t goal_pos = pos_symmetric(info, sym, info->goal_pos[color]);
+
+      matches = 0;
+
+      for (size_t other=0; other<info->num_colors; ++other) {
+        if ((init_pos == info->init_pos[other] &&
+             goal_pos == info->goal_pos[other]) ||
+            (init_pos == info->goal_pos[other] &&
+             goal_pos == info->init_pos[other])) {
+          matches = 1;
+          break;
+        }
+      }
+
+    }
+
+    if (matches) {
+      info->symmetries[info->num_symmetries++] = sym;
+    }
 
-  if (!fp) {
-    fprintf(stderr, "error opening %s\n", filename);
-    return 0;
   }
 
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read game board from an open text file. The filename is only used
+// in error messages.
+
+int game_read_fp(FILE* fp,
+                 const char* filename,
+                 game_info_t* info,
+                 game_state_t* state) {
+
   int is_alternate_format = detect_format(fp);
 
   memset(info, 0, sizeof(game_info_t));
@@ -933,6 +1559,10 @@ int game_read(const char* filename,
   memset(info->init_pos, 0xff, sizeof(info->init_pos));
   memset(info->goal_pos, 0xff, sizeof(info->goal_pos));
 
+  for (int dir=0; dir<4; ++dir) {
+    info->dir_order[dir] = dir;
+  }
+
   while (info->size == 0 || y < info->size) {
 
     char* s = fgets(buf, MAX_SIZE+1, fp);
@@ -940,11 +1570,9 @@ int game_read(const char* filename,
     
     if (!s) {
       fprintf(stderr, "%s:%zu: unexpected EOF\n", filename, y+1);
-      fclose(fp);
       return 0;
     } else if (s[l-1] != '\n') {
       fprintf(stderr, "%s:%zu line too long\n", filename, y+1);
-      fclose(fp);
       return 0;
     }
 
@@ -956,11 +1584,9 @@ int game_read(const char* filename,
       if (l < 3) {
         fprintf(stderr, "%s:1: expected at least 3 characters before newline\n",
                 filename);
-        fclose(fp);
         return 0;
       } else if (l-1 > MAX_SIZE) {
         fprintf(stderr, "%s:1: size too big!\n", filename);
-        fclose(fp);
         return 0;
       }
       info->size = l-1;
@@ -969,7 +1595,6 @@ int game_read(const char* filename,
               "(expected %zu, but got %zu)\n",
               filename, y+1,
               info->size, l-1);
-      fclose(fp);
       return 0;
     }
 
@@ -992,7 +1617,6 @@ int game_read(const char* filename,
             fprintf(stderr, "%s:%zu: can't use color %c"
                     "- too many colors!\n",
                     filename, y+1, c);
-            fclose(fp);
             return 0;
 
           }
@@ -1001,7 +1625,6 @@ int game_read(const char* filename,
           if (id < 0 || id >= MAX_COLORS) {
             fprintf(stderr, "%s:%zu: unrecognized color %c\n",
                     filename, y+1, c);
-            fclose(fp);
             return 0;
           }
 
@@ -1018,7 +1641,6 @@ int game_read(const char* filename,
           if (info->goal_pos[color] != INVALID_POS) {
             fprintf(stderr, "%s:%zu too many %c already!\n",
                     filename, y+1, c);
-            fclose(fp);
             return 0;
           }
           info->goal_pos[color] = pos;
@@ -1036,8 +1658,6 @@ int game_read(const char* filename,
     ++y;
   }
 
-  fclose(fp);
-
   if (!info->num_colors) {
     fprintf(stderr, "empty map!\n");
     return 0;
@@ -1069,12 +1689,38 @@ int game_read(const char* filename,
 
     }
 
+    state->tail[color] = info->goal_pos[color];
+
   }
+
+  game_find_symmetries(info);
   
   return 1;
 
 }
 
+//////////////////////////////////////////////////////////////////////
+// Read game board from text file
+
+int game_read(const char* filename,
+              game_info_t* info,
+              game_state_t* state) {
+
+  FILE* fp = fopen(filename, "r");
+
+  if (!fp) {
+    fprintf(stderr, "error opening %s\n", filename);
+    return 0;
+  }
+
+  int result = game_read_fp(fp, filename, info, state);
+
+  fclose(fp);
+
+  return result;
+
+}
+
 //////////////////////////////////////////////////////////////////////
 // Read hint file
 
@@ -1123,6 +1769,52 @@ int game_read_hint(const game_info_t* info,
   
 }
 
+//////////////////////////////////////////////////////////////////////
+// Add a hint board read by game_read_hint to the soft hints: moving
+// any other color into a cell it names costs more. The extra cost is
+// the weight of the board, scaled by how many of the endpoints it
+// names correctly, so that a board that is badly wrong barely
+// changes the search.
+
+void hint_add(const game_info_t* info,
+              hint_t* hint,
+              const uint8_t cells[MAX_CELLS],
+              double weight) {
+
+  size_t known = 0, agree = 0;
+
+  for (size_t color=0; color<info->num_colors; ++color) {
+    pos_t ends[2] = { info->init_pos[color], info->goal_pos[color] };
+    for (int i=0; i<2; ++i) {
+      if (cells[ends[i]] < info->num_colors) {
+        ++known;
+        agree += (cells[ends[i]] == color);
+      }
+    }
+  }
+
+  if (known) {
+    weight *= (double)agree / known;
+  }
+
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+
+      pos_t pos = pos_from_coords(x, y);
+
+      if (cells[pos] >= info->num_colors) { continue; }
+
+      for (size_t color=0; color<info->num_colors; ++color) {
+        if (color != cells[pos]) {
+          hint->penalty[pos][color] += weight;
+        }
+      }
+
+    }
+  }
+
+}
+
 //////////////////////////////////////////////////////////////////////
 // Pick the next color to move deterministically
 
@@ -1141,7 +1833,7 @@ int game_next_move_color(const game_info_t* info,
       g_options.order_most_constrained) {
 
     size_t best_color = -1;
-    int best_free = 4;
+    int best_free = 5;
 
     /*
     size_t worst_color = -1;
@@ -1159,6 +1851,12 @@ int game_next_move_color(const game_info_t* info,
       int num_free = game_num_free_pos(info, state,
                                        state->pos[color]);
 
+      if (g_options.search_both_ends) {
+        int tail_free = game_num_free_pos(info, state,
+                                          state->tail[color]);
+        if (tail_free < num_free) { num_free = tail_free; }
+      }
+
       if (num_free < best_free) {
         best_free = num_free;
         best_color = color;
@@ -1202,50 +1900,170 @@ int game_next_move_color(const game_info_t* info,
 }
 
 //////////////////////////////////////////////////////////////////////
-// Compare 2 ints
+// When paths can grow from both ends, pick the end of the given color
+// to move next: the tail if it is more constrained than the head.
 
-int cmp(int a, int b) {
-  return a < b ? -1 : a > b ? 1 : 0;
+int game_next_move_end(const game_info_t* info,
+                       const game_state_t* state,
+                       int color) {
+
+  if (!g_options.search_both_ends) {
+    return 0;
+  }
+
+  return (game_num_free_pos(info, state, state->tail[color]) <
+          game_num_free_pos(info, state, state->pos[color]));
+  
 }
 
 //////////////////////////////////////////////////////////////////////
-// For sorting colors
+// On a symmetric board, find the moves of the given color that
+// mirror moves coming earlier in info->dir_order. A symmetry that
+// maps the state onto itself (with colors permuted) and leaves the
+// head of the color in place maps the subtree of each of its moves
+// onto the subtree of another, so only the first of them needs
+// searching. Returns a bitmask of the directions to skip.
+
+uint8_t game_symmetric_moves(const game_info_t* info,
+                             const game_state_t* state,
+                             int color) {
+
+  uint8_t skip = 0;
+  pos_t pos = state->pos[color];
 
-int color_features_compare(const void* vptr_a, const void* vptr_b) {
+  int rank[4];
 
-  const color_features_t* a = (const color_features_t*)vptr_a;
-  const color_features_t* b = (const color_features_t*)vptr_b;
+  for (int d=0; d<4; ++d) {
+    rank[info->dir_order[d]] = d;
+  }
 
-  int u = cmp(a->user_index, b->user_index);
-  if (u) { return u; }
+  for (size_t i=0; i<info->num_symmetries; ++i) {
 
-  int w = cmp(a->wall_dist[0], b->wall_dist[0]);
-  if (w) { return w; }
+    int sym = info->symmetries[i];
 
-  int g = -cmp(a->wall_dist[1], b->wall_dist[1]);
-  if (g) { return g; }
+    if (pos_symmetric(info, sym, pos) != pos) { continue; }
 
-  return -cmp(a->min_dist, b->min_dist);
+    uint8_t colors[MAX_COLORS];
+    memset(colors, 0xff, sizeof(colors));
 
-}
+    int matches = 1;
 
-//////////////////////////////////////////////////////////////////////
-// Place the game colors into a set order
+    for (size_t y=0; y<info->size && matches; ++y) {
+      for (size_t x=0; x<info->size && matches; ++x) {
 
-void game_order_colors(game_info_t* info,
-                       game_state_t* state,
-                       const char* user_order) {
+        pos_t p = pos_from_coords(x, y);
+        cell_t cell = state->cells[p];
+        cell_t image = state->cells[pos_symmetric(info, sym, p)];
 
-  if (g_options.order_random) {
-    
-    srand(now() * 1e6);
-    
-    for (size_t i=info->num_colors-1; i>0; --i) {
-      size_t j = rand() % (i+1);
-      int tmp = info->color_order[i];
-      info->color_order[i] = info->color_order[j];
-      info->color_order[j] = tmp;
-    }
+        if (!cell || !image) {
+          matches = (!cell && !image);
+        } else {
+          uint8_t* c = colors + cell_get_color(cell);
+          if (*c == 0xff) { *c = cell_get_color(image); }
+          matches = (*c == cell_get_color(image));
+        }
+
+      }
+    }
+
+    // Incomplete paths must have their ends in the same places
+    for (size_t c=0; c<info->num_colors && matches; ++c) {
+
+      int other = colors[c];
+      int done = (state->completed >> c) & 1;
+
+      if (done != ((state->completed >> other) & 1)) {
+        matches = 0;
+      } else if (!done) {
+        pos_t head = pos_symmetric(info, sym, state->pos[c]);
+        pos_t tail = pos_symmetric(info, sym, state->tail[c]);
+        matches = ((head == state->pos[other] &&
+                    tail == state->tail[other]) ||
+                   (head == state->tail[other] &&
+                    tail == state->pos[other]));
+      }
+
+    }
+
+    if (!matches) { continue; }
+
+    for (int dir=0; dir<4; ++dir) {
+      uint8_t image = sym_dir_flags(sym, 1 << dir);
+      for (int sdir=0; sdir<4; ++sdir) {
+        if ((image & (1 << sdir)) && rank[sdir] < rank[dir]) {
+          skip |= (1 << dir);
+        }
+      }
+    }
+
+  }
+
+  return skip;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Compare 2 ints
+
+int cmp(int a, int b) {
+  return a < b ? -1 : a > b ? 1 : 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// For sorting colors
+
+int color_features_compare(const void* vptr_a, const void* vptr_b) {
+
+  const color_features_t* a = (const color_features_t*)vptr_a;
+  const color_features_t* b = (const color_features_t*)vptr_b;
+
+  int u = cmp(a->user_index, b->user_index);
+  if (u) { return u; }
+
+  int w = cmp(a->wall_dist[0], b->wall_dist[0]);
+  if (w) { return w; }
+
+  int g = -cmp(a->wall_dist[1], b->wall_dist[1]);
+  if (g) { return g; }
+
+  return -cmp(a->min_dist, b->min_dist);
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Shuffle the color order and the order of moves to try, so that
+// ties get broken differently. The same seed gives the same order.
+
+void game_shuffle_order(game_info_t* info, unsigned seed) {
+
+  srand(seed);
+    
+  for (size_t i=info->num_colors-1; i>0; --i) {
+    size_t j = rand() % (i+1);
+    int tmp = info->color_order[i];
+    info->color_order[i] = info->color_order[j];
+    info->color_order[j] = tmp;
+  }
+
+  for (int i=3; i>0; --i) {
+    int j = rand() % (i+1);
+    int tmp = info->dir_order[i];
+    info->dir_order[i] = info->dir_order[j];
+    info->dir_order[j] = tmp;
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Place the game colors into a set order
+
+void game_order_colors(game_info_t* info,
+                       game_state_t* state,
+                       const char* user_order) {
+
+  if (g_options.order_random) {
+
+    game_shuffle_order(info, g_options.order_seed);
 
   } else { // not random
 
@@ -1307,6 +2125,10 @@ void game_order_colors(game_info_t* info,
   }
 
   if (!g_options.display_quiet) {
+
+    if (g_options.order_random) {
+      printf("shuffled colors with seed %u\n", g_options.order_seed);
+    }
     
     if (g_options.order_most_constrained && !user_order) {
       printf("will choose color by most constrained\n");
@@ -1468,67 +2290,234 @@ void game_regions_add_color(const game_info_t* info,
 }
 
 //////////////////////////////////////////////////////////////////////
-// Helper function for below
+// Fill in the local pattern tables. A free cell is a dead end if at
+// most one of its neighbors is free or an endpoint; if none of them
+// are free, some color must pass through it from its current position
+// straight to its goal. A 2x2 block of free cells whose surrounding
+// cells are not free can only be filled by colors with both endpoints
+// among those cells. Without the touch test, one color can fill it,
+// but otherwise it takes at least two.
+
+void patterns_setup() {
+
+  for (int idx=0; idx<(1 << 8); ++idx) {
+
+    int count[4] = { 0, 0, 0, 0 };
+
+    for (int i=0; i<4; ++i) {
+      ++count[(idx >> (2*i)) & 3];
+    }
+
+    if (count[PATTERN_FREE] + count[PATTERN_CUR] + count[PATTERN_GOAL] <= 1) {
+      g_cell_patterns[idx] = CELL_DEADEND;
+    } else if (count[PATTERN_FREE]) {
+      g_cell_patterns[idx] = CELL_OK;
+    } else if (count[PATTERN_CUR] && count[PATTERN_GOAL]) {
+      g_cell_patterns[idx] = CELL_SQUEEZED;
+    } else {
+      g_cell_patterns[idx] = CELL_DEADEND;
+    }
+
+  }
+
+  int colors_needed = g_options.node_check_touch ? 2 : 1;
+
+  for (int idx=0; idx<(1 << 16); ++idx) {
+
+    int count[4] = { 0, 0, 0, 0 };
+
+    for (int i=0; i<8; ++i) {
+      ++count[(idx >> (2*i)) & 3];
+    }
+
+    g_block_patterns[idx] = (!count[PATTERN_FREE] &&
+                             (count[PATTERN_CUR] < colors_needed ||
+                              count[PATTERN_GOAL] < colors_needed));
+
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Get the pattern class of the cell at the given coordinates, given
+// bitboards of current and goal positions of active colors.
+
+int game_cell_class(const game_info_t* info,
+                    const game_state_t* state,
+                    const bitboard_t ends[2],
+                    int x, int y) {
+
+  if (x < 0 || x >= info->size || y < 0 || y >= info->size) {
+    return PATTERN_BLOCKED;
+  }
+
+  pos_t pos = pos_from_coords(x, y);
+  
+  if (!state->cells[pos]) {
+    return PATTERN_FREE;
+  } else if (bitboard_test(&ends[0], pos)) {
+    return PATTERN_CUR;
+  } else if (bitboard_test(&ends[1], pos)) {
+    return PATTERN_GOAL;
+  } else {
+    return PATTERN_BLOCKED;
+  }
+  
+}
+
+//////////////////////////////////////////////////////////////////////
+// Helper function for below -- look up the neighbors of a free cell
+// in the pattern table.
 
 int game_is_deadend(const game_info_t* info,
                     const game_state_t* state,
+                    const bitboard_t ends[2],
                     pos_t pos) {
 
   assert(pos != INVALID_POS && !state->cells[pos]);
 
   int x, y;
   pos_get_coords(pos, &x, &y);
-  
-  int num_free = 0;
+
+  int idx = 0;
 
   for (int dir=0; dir<4; ++dir) {
-    pos_t neighbor_pos = offset_pos(info, x, y, dir);
-    if (neighbor_pos != INVALID_POS) {
-      if (!state->cells[neighbor_pos]) {
-        ++num_free;
-      } else {
-        for (size_t color=0; color<info->num_colors; ++color) {
-          if (state->completed & (1 << color)) {
-            continue;
-          }
-          if (neighbor_pos == state->pos[color] ||
-              neighbor_pos == info->goal_pos[color]) {
-            ++num_free;
-          }
-        }
-                                                                 
+    idx |= game_cell_class(info, state, ends,
+                           x + DIR_DELTA[dir][0],
+                           y + DIR_DELTA[dir][1]) << (2*dir);
+  }
+
+  int result = g_cell_patterns[idx];
+
+  if (result != CELL_SQUEEZED) {
+    return result;
+  }
+
+  // See if a neighboring current position has its goal next to us.
+  for (int dir=0; dir<4; ++dir) {
+    if (((idx >> (2*dir)) & 3) != PATTERN_CUR) { continue; }
+    int color = cell_get_color(state->cells[pos + DIR_DELTA[dir][2]]);
+    for (int gdir=0; gdir<4; ++gdir) {
+      if (((idx >> (2*gdir)) & 3) == PATTERN_GOAL &&
+          pos + DIR_DELTA[gdir][2] == state->tail[color]) {
+        return 0;
       }
     }
   }
 
-  return num_free <= 1;
+  return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Helper function for below -- look up the cells around the 2x2
+// block with the given upper-left corner in the pattern table, if
+// the block is all free.
+
+int game_is_dead_block(const game_info_t* info,
+                       const game_state_t* state,
+                       const bitboard_t ends[2],
+                       int x, int y) {
+
+  if (x < 0 || x+1 >= info->size || y < 0 || y+1 >= info->size) {
+    return 0;
+  }
+
+  pos_t pos = pos_from_coords(x, y);
+
+  if (state->cells[pos] || state->cells[pos+1] ||
+      state->cells[pos+16] || state->cells[pos+17]) {
+    return 0;
+  }
+
+  // Clockwise from above the upper-left corner
+  const int ring[8][2] = {
+    { 0, -1 }, { 1, -1 }, { 2, 0 }, { 2, 1 },
+    { 1, 2 }, { 0, 2 }, { -1, 1 }, { -1, 0 }
+  };
+
+  int idx = 0;
+
+  for (int i=0; i<8; ++i) {
+    idx |= game_cell_class(info, state, ends,
+                           x + ring[i][0], y + ring[i][1]) << (2*i);
+  }
+
+  return g_block_patterns[idx];
 
 }
 
 //////////////////////////////////////////////////////////////////////
 // Check for dead-end regions of freespace where there is no way to
-// put an active path into and out of it. Any freespace node which
-// has only one free neighbor represents such a dead end. For the
-// purposes of this check, cur and goal positions count as "free".
+// put an active path into and out of it. The last move changed the
+// neighborhoods of cells around the color's current position, its
+// previous position, and its goal if it just got completed, so look
+// up the free cells and 2x2 free blocks next to those in the local
+// pattern tables.
 
 int game_check_deadends(const game_info_t* info,
                         const game_state_t* state) {
 
   size_t color = state->last_color;
   if (color >= info->num_colors) { return 0; }
-  
+
+  bitboard_t ends[2];
+  memset(ends, 0, sizeof(ends));
+
+  for (size_t c=0; c<info->num_colors; ++c) {
+    if (!(state->completed & (1 << c))) {
+      bitboard_set(&ends[0], state->pos[c]);
+      bitboard_set(&ends[1], state->tail[c]);
+    }
+  }
+
   pos_t cur_pos = state->pos[color];
+  cell_t cur_cell = state->cells[cur_pos];
+  
+  pos_t changed[3] = { cur_pos, INVALID_POS, INVALID_POS };
 
-  int x, y;
-  pos_get_coords(cur_pos, &x, &y);
+  if (cell_get_type(cur_cell) == TYPE_PATH) {
+    changed[1] = pos_offset_pos(info, cur_pos,
+                                cell_get_direction(cur_cell) ^ 1);
+  }
 
-  for (int dir=0; dir<4; ++dir) {
-    pos_t neighbor_pos = offset_pos(info, x, y, dir);
-    if (neighbor_pos != INVALID_POS &&
-        !state->cells[neighbor_pos] &&
-        game_is_deadend(info, state, neighbor_pos)) {
-      return 1;
+  if (state->completed & (1 << color)) {
+    changed[2] = state->tail[color];
+  }
+
+  for (int i=0; i<3; ++i) {
+
+    if (changed[i] == INVALID_POS) { continue; }
+
+    int x, y;
+    pos_get_coords(changed[i], &x, &y);
+
+    for (int dir=0; dir<4; ++dir) {
+      
+      pos_t neighbor_pos = offset_pos(info, x, y, dir);
+      
+      if (neighbor_pos == INVALID_POS || state->cells[neighbor_pos]) {
+        continue;
+      }
+
+      if (game_is_deadend(info, state, ends, neighbor_pos)) {
+        return 1;
+      }
+
+      // Check the four blocks with this cell as a corner
+      int nx, ny;
+      pos_get_coords(neighbor_pos, &nx, &ny);
+
+      for (int by=ny-1; by<=ny; ++by) {
+        for (int bx=nx-1; bx<=nx; ++bx) {
+          if (game_is_dead_block(info, state, ends, bx, by)) {
+            return 1;
+          }
+        }
+      }
+      
     }
+    
   }
 
   return 0;
@@ -1577,11 +2566,11 @@ int game_regions_stranded(const game_info_t* info,
 
     // Add color flag to all regions for goal_pos
     game_regions_add_color(info, state, rmap,
-                           info->goal_pos[color],
+                           state->tail[color],
                            cflag, goal_rflags);
 
     if (!g_options.node_check_touch) {
-      int delta = state->pos[color] - info->goal_pos[color];
+      int delta = state->pos[color] - state->tail[color];
       delta = delta < 0 ? -delta : delta;
       if (delta == 1 || delta == 16) { // adjacent
         continue;
@@ -1631,124 +2620,193 @@ int game_regions_stranded(const game_info_t* info,
 }
 
 //////////////////////////////////////////////////////////////////////
-// Print connected components of freespace
-                        
-void game_print_regions(const game_info_t* info,
-                        const game_state_t* state,
-                        uint8_t rmap[MAX_CELLS]) {
+// Helper function for below -- try to find a free color for the
+// given region, moving other regions to different colors if needed
+// (Kuhn's augmenting path algorithm).
 
-  printf("%s", BLOCK_CHAR);
-  for (size_t x=0; x<info->size; ++x) {
-    printf("%s", BLOCK_CHAR);
-  }
-  printf("%s\n", BLOCK_CHAR);
+int game_match_region(const uint16_t* rcolors,
+                      int region,
+                      int color_region[MAX_COLORS],
+                      uint16_t* visited) {
 
-  for (size_t y=0; y<info->size; ++y) {
-    printf("%s", BLOCK_CHAR);
-    for (size_t x=0; x<info->size; ++x) {
-      pos_t pos = pos_from_coords(x, y);
-      pos_t rid = rmap[pos];
-      const color_lookup_t* l = &color_dict[rid % MAX_COLORS];
-      if (!state->cells[pos]) {
-        assert(rid != INVALID_POS);
-        char c = 65 + rid % 60;
-        printf("%s", color_char(l->ansi_code, c, c));
-      } else {
-        assert(rid == INVALID_POS);
-        printf(" ");
-      }
+  uint16_t candidates = rcolors[region] & ~*visited;
+
+  while (candidates) {
+    
+    int color = __builtin_ctz(candidates);
+    candidates &= candidates - 1;
+    
+    *visited |= (1 << color);
+    
+    if (color_region[color] < 0 ||
+        game_match_region(rcolors, color_region[color],
+                          color_region, visited)) {
+      color_region[color] = region;
+      return 1;
     }
-    printf("%s\n", BLOCK_CHAR);
+    
   }
 
-  printf("%s", BLOCK_CHAR);
-  for (size_t x=0; x<info->size; ++x) {
-    printf("%s", BLOCK_CHAR);
-  }
-  printf("%s\n", BLOCK_CHAR);
-  
-  printf("\n");
-  
+  return 0;
+
 }
 
 //////////////////////////////////////////////////////////////////////
-// Helper function for game_find_forced below.
-
-int game_is_forced(const game_info_t* info,
-                   const game_state_t* state,
-                   int color, pos_t pos) {
+// Helper function for below -- try to put the given color into one of
+// the regions it could use without exceeding region capacity, moving
+// other colors to different regions if needed.
+
+int game_match_color(const int copts[MAX_COLORS][4],
+                     const int* rcap,
+                     int* rload,
+                     int color,
+                     int color_region[MAX_COLORS],
+                     uint8_t* visited) {
+
+  for (int i=0; i<4 && copts[color][i] >= 0; ++i) {
+    
+    int region = copts[color][i];
+    if (visited[region]) { continue; }
+    visited[region] = 1;
 
-  int num_free = 0;
-  int num_other_endpoints = 0;
+    if (rload[region] < rcap[region]) {
+      ++rload[region];
+      color_region[color] = region;
+      return 1;
+    }
 
-  for (int dir=0; dir<4; ++dir) {
-    pos_t neighbor_pos = pos_offset_pos(info, pos, dir);
-    if (neighbor_pos == INVALID_POS ||
-        neighbor_pos == state->pos[color]) {
-      continue;
-    } else if (state->cells[neighbor_pos] == 0) {
-      ++num_free;
-    } else {
-      for (size_t other_color=0; other_color<info->num_colors; ++other_color) {
-        if (other_color == color) { continue; }
-        if (state->completed & (1 << other_color)) { continue; }
-        if (neighbor_pos == state->pos[other_color] ||
-            neighbor_pos == info->goal_pos[other_color]) {
-          ++num_other_endpoints;
-        }
+    for (int other=0; other<MAX_COLORS; ++other) {
+      if (color_region[other] == region &&
+          game_match_color(copts, rcap, rload, other,
+                           color_region, visited)) {
+        color_region[color] = region;
+        return 1;
       }
-    } 
-  } // for each neighbor
+    }
+    
+  }
 
-  return (num_free == 1 && num_other_endpoints == 0);
+  return 0;
 
 }
-                                         
-//////////////////////////////////////////////////////////////////////
-// Find a forced move. This could be optimized to not search all
-// colors all the time, maybe?
 
-int game_find_forced(const game_info_t* info,
-                     const game_state_t* state,
-                     int* forced_color,
-                     int* forced_dir) {
+//////////////////////////////////////////////////////////////////////
+// The path of an active color fills cells in exactly one region of
+// freespace: one touched by both its current and goal position. Each
+// region must be filled by at least one color, and can hold at most
+// as many colors as it has cells. Unlike game_regions_stranded, which
+// looks at colors and regions one at a time, make sure the colors can
+// be assigned to regions all at once. By Hall's theorem (and the
+// Mendelsohn-Dulmage theorem for combining the two), that holds if
+// every region can get its own color and every color can fit in some
+// region.
+
+int game_regions_unmatched(const game_info_t* info,
+                           const game_state_t* state,
+                           size_t rcount,
+                           const uint8_t rmap[MAX_CELLS]) {
+
+  // Nothing to match (and no zero-length arrays below)
+  if (!rcount) { return 0; }
 
-  // if there is a freespace next to an endpoint and the freespace has
-  // only one free neighbor, we must extend the endpoint into it.
+  uint16_t cur_rflags[rcount];
+  uint16_t goal_rflags[rcount];
+  uint16_t rcolors[rcount];
+  int rcap[rcount];
+  int rload[rcount];
+  uint8_t visited[rcount];
+  
+  int copts[MAX_COLORS][4];
+  int color_region[MAX_COLORS];
 
-  for (size_t i=0; i<info->num_colors; ++i) {
-
-    size_t color = info->color_order[i];
+  memset(cur_rflags, 0, sizeof(cur_rflags));
+  memset(goal_rflags, 0, sizeof(goal_rflags));
+  memset(rcap, 0, sizeof(rcap));
+  memset(rload, 0, sizeof(rload));
 
-    if (state->completed & (1 << color)) { continue; }
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+      pos_t rid = rmap[pos_from_coords(x, y)];
+      if (rid != INVALID_POS) { ++rcap[rid]; }
+    }
+  }
 
+  uint16_t active = 0, optional = 0;
 
-      int free_dir = -1;
-      int num_free = 0;
+  for (size_t color=0; color<info->num_colors; ++color) {
 
-      for (int dir=0; dir<4; ++dir) {
+    uint16_t cflag = (1 << color);
+    
+    if (state->completed & cflag) { continue; }
 
-        pos_t neighbor_pos = pos_offset_pos(info, state->pos[color], dir);
-        if (neighbor_pos == INVALID_POS) { continue; }
+    // Without the touch test, a color next to its goal needs no
+    // region at all, but it can still fill one.
+    int delta = state->pos[color] - state->tail[color];
+    delta = delta < 0 ? -delta : delta;
 
-        if (state->cells[neighbor_pos] == 0) {
+    if (!g_options.node_check_touch && (delta == 1 || delta == 16)) {
+      optional |= cflag;
+    } else {
+      active |= cflag;
+    }
 
-          free_dir = dir;
-          ++num_free;
+    game_regions_add_color(info, state, rmap, state->pos[color],
+                           cflag, cur_rflags);
+    
+    game_regions_add_color(info, state, rmap, state->tail[color],
+                           cflag, goal_rflags);
+    
+  }
 
-          if (game_is_forced(info, state, color, neighbor_pos)) {
+  // Can't give each region its own color if there are more of them.
+  if ((int)rcount > __builtin_popcount(active | optional)) {
+    return 1;
+  }
 
-            *forced_color = color;
-            *forced_dir = dir;
+  for (size_t r=0; r<rcount; ++r) {
+    rcolors[r] = cur_rflags[r] & goal_rflags[r];
+  }
 
-            return 1;
+  // Every region gets a different color
+  for (int color=0; color<MAX_COLORS; ++color) {
+    color_region[color] = -1;
+  }
 
-          }
+  for (size_t r=0; r<rcount; ++r) {
+    uint16_t color_visited = 0;
+    if (!game_match_region(rcolors, r, color_region, &color_visited)) {
+      return 1;
+    }
+  }
 
+  // Every color gets a region with room for it
+  for (int color=0; color<MAX_COLORS; ++color) {
+    
+    color_region[color] = -1;
+    
+    int n = 0;
+    
+    if (active & (1 << color)) {
+      for (size_t r=0; r<rcount; ++r) {
+        if (rcolors[r] & (1 << color)) {
+          copts[color][n++] = r;
+          if (n == 4) { break; }
         }
+      }
+    }
+    
+    if (n < 4) { copts[color][n] = -1; }
+    
+  }
 
-      } // for each neighbor      
-
+  for (int color=0; color<MAX_COLORS; ++color) {
+    if (active & (1 << color)) {
+      memset(visited, 0, sizeof(visited));
+      if (!game_match_color(copts, rcap, rload, color,
+                            color_region, visited)) {
+        return 1;
+      }
+    }
   }
 
   return 0;
@@ -1756,1072 +2814,6996 @@ int game_find_forced(const game_info_t* info,
 }
 
 //////////////////////////////////////////////////////////////////////
-// Create simple linear allocator for search nodes.
+// Helper function for below -- get the checkerboard color of a cell,
+// +1 for black or -1 for white.
 
-node_storage_t node_storage_create(size_t max_nodes) {
+int pos_parity(pos_t pos) {
+  return ((pos ^ (pos >> 4)) & 1) ? -1 : 1;
+}
 
-  node_storage_t storage;
-  
-  storage.start = malloc(max_nodes*sizeof(tree_node_t));
-  
-  if (!storage.start) {
-    fprintf(stderr, "unable to allocate memory for node storage!\n");
-    exit(1);
-  }
+//////////////////////////////////////////////////////////////////////
+// Paths alternate between black and white cells. The free cells
+// filled by an active color start next to its current position and
+// end next to its goal, so if those two have the same checkerboard
+// color, the path fills one more cell of the opposite color;
+// otherwise it fills the same number of each. Since every free cell
+// gets filled, the black/white imbalance of free space must be
+// exactly the sum of these, and the imbalance of each region must be
+// within what the colors able to use it can make up.
+
+int game_regions_parity(const game_info_t* info,
+                        const game_state_t* state,
+                        size_t rcount,
+                        const uint8_t rmap[MAX_CELLS]) {
 
-  storage.capacity = max_nodes;
-  storage.count = 0;
+  // No free cells, so nothing to balance (and no zero-length arrays)
+  if (!rcount) { return 0; }
 
-  return storage;
-    
-}
+  int rimbalance[rcount];
+  int rblack[rcount];
+  int rwhite[rcount];
 
-//////////////////////////////////////////////////////////////////////
-// Allocate the next tree node.
+  memset(rimbalance, 0, sizeof(rimbalance));
+  memset(rblack, 0, sizeof(rblack));
+  memset(rwhite, 0, sizeof(rwhite));
 
-tree_node_t* node_storage_alloc(node_storage_t* storage) {
-  if (storage->count >= storage->capacity) {
-    return NULL;
+  int total = 0;
+  
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+      pos_t pos = pos_from_coords(x, y);
+      if (rmap[pos] != INVALID_POS) {
+        rimbalance[rmap[pos]] += pos_parity(pos);
+        total += pos_parity(pos);
+      }
+    }
   }
-  tree_node_t* rval = storage->start + storage->count;
-  ++storage->count;
-  return rval;
-}
-
-//////////////////////////////////////////////////////////////////////
-// De-allocate a tree node -- note that we can only safely de-allocate
-// the last node that was allocated. Of course we only check this with
-// an assert, tho.
 
-void node_storage_unalloc(node_storage_t* storage,
-                          const tree_node_t* n) {
+  for (size_t color=0; color<info->num_colors; ++color) {
 
-  assert( storage->count && n == storage->start + storage->count - 1 );
-  --storage->count;
+    uint16_t cflag = (1 << color);
 
-}
+    if (state->completed & cflag) { continue; }
 
-//////////////////////////////////////////////////////////////////////
-// Free the memory allocated for this.
+    int cur_parity = pos_parity(state->pos[color]);
+    if (cur_parity != pos_parity(state->tail[color])) { continue; }
 
-void node_storage_destroy(node_storage_t* storage) {
-  free(storage->start);
-}
+    // One extra cell of the opposite parity
+    total += cur_parity;
 
-//////////////////////////////////////////////////////////////////////
-// Compare total cost for nodes, used by heap functions below.
+    uint16_t cur_rflags[rcount];
+    uint16_t goal_rflags[rcount];
 
-int node_compare(const tree_node_t* a,
-                 const tree_node_t* b) {
+    memset(cur_rflags, 0, sizeof(cur_rflags));
+    memset(goal_rflags, 0, sizeof(goal_rflags));
 
-  double af = a->cost_to_come + a->cost_to_go;
-  double bf = b->cost_to_come + b->cost_to_go;
+    game_regions_add_color(info, state, rmap, state->pos[color],
+                           cflag, cur_rflags);
+    
+    game_regions_add_color(info, state, rmap, state->tail[color],
+                           cflag, goal_rflags);
 
-  if (af != bf) {
-    return af < bf ? -1 : 1;
-  } else {
-    return a < b ? -1 : 1;
+    for (size_t r=0; r<rcount; ++r) {
+      if (cur_rflags[r] & goal_rflags[r]) {
+        if (cur_parity < 0) {
+          ++rblack[r];
+        } else {
+          ++rwhite[r];
+        }
+      }
+    }
+    
   }
 
-}
-
-//////////////////////////////////////////////////////////////////////
-// Create a binary heap to store the given # of nodes
+  if (total) {
+    return 1;
+  }
 
-queue_t heapq_create(size_t max_nodes) {
-  queue_t rval;
-  rval.heapq.start = malloc(sizeof(tree_node_t*) * max_nodes);
-  if (!rval.heapq.start) {
-    fprintf(stderr, "out of memory creating heapq!\n");
-    exit(1);
+  for (size_t r=0; r<rcount; ++r) {
+    if (rimbalance[r] > rblack[r] || -rimbalance[r] > rwhite[r]) {
+      return 1;
+    }
   }
-  rval.heapq.count = 0;
-  rval.heapq.capacity = max_nodes;
-  return rval;
+
+  return 0;
+  
 }
 
 //////////////////////////////////////////////////////////////////////
-// Indexing macros for heaps
+// Get the set of free cells on the board.
 
-#define HEAPQ_PARENT_INDEX(i) (((i)-1)/2)
-#define HEAPQ_LCHILD_INDEX(i) ((2*(i))+1)
+bitboard_t game_free_bits(const game_info_t* info,
+                          const game_state_t* state) {
 
-//////////////////////////////////////////////////////////////////////
-// For debugging, not used presently
+  bitboard_t free;
+  memset(&free, 0, sizeof(free));
 
-int heapq_valid(const queue_t* q) {
-  for (size_t i=1; i<q->heapq.count; ++i) {
-    const tree_node_t* tc = q->heapq.start[i];
-    const tree_node_t* tp = q->heapq.start[HEAPQ_PARENT_INDEX(i)];
-    if (node_compare(tp, tc) > 0) {
-      return 0;
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+      pos_t pos = pos_from_coords(x, y);
+      if (!state->cells[pos]) {
+        bitboard_set(&free, pos);
+      }
     }
   }
-  return 1;
-}
 
-//////////////////////////////////////////////////////////////////////
-// Is heap queue empty?
+  return free;
 
-int heapq_empty(const queue_t* q) {
-  return q->heapq.count == 0;
 }
 
 //////////////////////////////////////////////////////////////////////
-// Peek at the next item to be removed
+// Find the number of moves the given color needs to get from its
+// current position to its goal through free space, by expanding a
+// breadth-first frontier over the whole board at once. Returns
+// MAX_CELLS if the goal is unreachable.
 
-const tree_node_t* heapq_peek(const queue_t* q) {
-  assert(!heapq_empty(q));
-  return q->heapq.start[0];
-}
+int game_color_distance(const game_info_t* info,
+                        const game_state_t* state,
+                        const bitboard_t* free,
+                        int color) {
 
-//////////////////////////////////////////////////////////////////////
-// Enqueue a node onto the heap
+  pos_t goal_pos = state->tail[color];
 
-void heapq_enqueue(queue_t* q, tree_node_t* node) {
+  bitboard_t frontier, visited;
+  memset(&frontier, 0, sizeof(frontier));
 
-  assert(q->heapq.count < q->heapq.capacity);
+  bitboard_set(&frontier, state->pos[color]);
+  visited = frontier;
+
+  for (int dist=1; ; ++dist) {
+
+    bitboard_t next = bitboard_dilate(&frontier);
+
+    if (bitboard_test(&next, goal_pos)) {
+      return dist;
+    }
+
+    for (int i=0; i<4; ++i) {
+      frontier.words[i] = next.words[i] & free->words[i] & ~visited.words[i];
+      visited.words[i] |= frontier.words[i];
+    }
+
+    if (bitboard_empty(&frontier)) {
+      return MAX_CELLS;
+    }
 
-  size_t i = q->heapq.count++;
-  size_t pi = HEAPQ_PARENT_INDEX(i);
-  
-  q->heapq.start[i] = node;
-  
-  while (i > 0 && node_compare(q->heapq.start[pi], q->heapq.start[i]) > 0) {
-    tree_node_t* tmp = q->heapq.start[pi];
-    q->heapq.start[pi] = q->heapq.start[i];
-    q->heapq.start[i] = tmp;
-    i = pi;
-    pi = HEAPQ_PARENT_INDEX(i);
   }
-                      
+  
 }
 
 //////////////////////////////////////////////////////////////////////
-// Helper function used for dequeueing
+// Make sure every active color can still reach its goal, and that
+// the free cells needed by the shortest paths fit in free space: the
+// paths of colors confined to a single region must fit in that
+// region, and all of the paths together must fit on the board.
 
-void _heapq_repair(queue_t* q, size_t i) {
+int game_check_distances(const game_info_t* info,
+                         const game_state_t* state,
+                         size_t rcount,
+                         const uint8_t rmap[MAX_CELLS]) {
 
-  size_t li = HEAPQ_LCHILD_INDEX(i);
-  size_t ri = li + 1;
-  size_t smallest = i;
+  bitboard_t free = game_free_bits(info, state);
 
-  if (li < q->heapq.count &&
-      node_compare(q->heapq.start[i], q->heapq.start[li]) > 0) {
-    smallest = li;
-  }
+  // One extra, since arrays can't be empty when nothing is free
+  int rsize[rcount+1];
+  int rneeded[rcount+1];
 
-  if (ri < q->heapq.count &&
-      node_compare(q->heapq.start[smallest], q->heapq.start[ri]) > 0) {
-    smallest = ri;
+  memset(rsize, 0, sizeof(rsize));
+  memset(rneeded, 0, sizeof(rneeded));
+
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+      pos_t rid = rmap[pos_from_coords(x, y)];
+      if (rid != INVALID_POS) { ++rsize[rid]; }
+    }
   }
 
-  if (smallest != i){
-    tree_node_t* tmp = q->heapq.start[i];
-    q->heapq.start[i] = q->heapq.start[smallest];
-    q->heapq.start[smallest] = tmp;
-    _heapq_repair(q, smallest);
-  }    
+  int total_needed = 0;
 
-}
+  for (size_t color=0; color<info->num_colors; ++color) {
 
-//////////////////////////////////////////////////////////////////////
-// Pop a node off the heap
+    if (state->completed & (1 << color)) { continue; }
 
-tree_node_t* heapq_deque(queue_t* q) {
+    int dist = game_color_distance(info, state, &free, color);
+    if (dist == MAX_CELLS) { return 1; }
 
-  assert(!heapq_empty(q));
+    // Number of free cells the path will fill
+    int needed = dist - 1;
+    total_needed += needed;
 
-  tree_node_t* rval = q->heapq.start[0];
-  --q->heapq.count;
+    // Find the regions touched by both the current and goal
+    // positions; if there is just one, the path must go through it.
+    int region = INVALID_POS;
+    int num_regions = 0;
+
+    for (int i=0; i<4; ++i) {
+      
+      pos_t cur_neighbor = pos_offset_pos(info, state->pos[color], i);
+      if (cur_neighbor == INVALID_POS) { continue; }
+      
+      int cur_region = rmap[cur_neighbor];
+      if (cur_region == INVALID_POS || cur_region == region) { continue; }
+
+      for (int j=0; j<4; ++j) {
+        pos_t goal_neighbor = pos_offset_pos(info, state->tail[color], j);
+        if (goal_neighbor != INVALID_POS &&
+            rmap[goal_neighbor] == cur_region) {
+          region = cur_region;
+          ++num_regions;
+          break;
+        }
+      }
+      
+    }
+
+    if (num_regions == 1) {
+      rneeded[region] += needed;
+      if (rneeded[region] > rsize[region]) {
+        return 1;
+      }
+    }
 
-  if (q->heapq.count) {
-    q->heapq.start[0] = q->heapq.start[q->heapq.count];
-    _heapq_repair(q, 0);
   }
-  
-  return rval;
+
+  return total_needed > state->num_free;
   
 }
 
 //////////////////////////////////////////////////////////////////////
-// Free memory allocated for heap
-
-void heapq_destroy(queue_t* q) {
-  free(q->heapq.start);
-}
+// Find the domain of each active color: the set of free cells it
+// could still fill. That is every cell reachable from the color's
+// current position through free space without stepping next to the
+// color's own path, which node_check_touch forbids everywhere but on
+// the very next move -- as long as the goal is reachable that way at
+// all. Those next moves are stored in first for each color. Returns
+// nonzero if some color can no longer reach its goal.
+
+int game_build_domains(const game_info_t* info,
+                       const game_state_t* state,
+                       bitboard_t domains[MAX_COLORS],
+                       bitboard_t first[MAX_COLORS]) {
+
+  // Free cells, and path cells of each color including the current
+  // position but not the tail.
+  bitboard_t free;
+  bitboard_t trail[MAX_COLORS];
+  
+  memset(&free, 0, sizeof(free));
+  memset(trail, 0, sizeof(trail));
 
-//////////////////////////////////////////////////////////////////////
-// FIFO via flat array
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+      pos_t pos = pos_from_coords(x, y);
+      cell_t cell = state->cells[pos];
+      if (!cell) {
+        bitboard_set(&free, pos);
+      } else if (g_options.node_check_touch) {
+        bitboard_set(&trail[cell_get_color(cell)], pos);
+      }
+    }
+  }
 
-queue_t fifo_create(size_t max_nodes) {
-  queue_t rval;
-  rval.fifo.start = malloc(sizeof(tree_node_t*) * max_nodes);
-  if (!rval.fifo.start) {
-    fprintf(stderr, "out of memory creating fifo!\n");
-    exit(1);
+  for (size_t color=0; color<info->num_colors; ++color) {
+    pos_t tail_pos = state->tail[color];
+    trail[color].words[tail_pos >> 6] &= ~((uint64_t)1 << (tail_pos & 63));
   }
-  rval.fifo.count = 0;
-  rval.fifo.capacity = max_nodes;
-  rval.fifo.next = 0;
-  return rval;
-}
-
-//////////////////////////////////////////////////////////////////////
-// Check if empty
 
-int fifo_empty(const queue_t* q) {
-  return q->fifo.next == q->fifo.count;
-}
-
-//////////////////////////////////////////////////////////////////////
-// Push node into FIFO
-
-void fifo_enqueue(queue_t* q, tree_node_t* n) {
-  assert(q->fifo.count < q->fifo.capacity);
-  q->fifo.start[q->fifo.count++] = n;
-}
+  memset(domains, 0, MAX_COLORS*sizeof(bitboard_t));
+  memset(first, 0, MAX_COLORS*sizeof(bitboard_t));
 
-//////////////////////////////////////////////////////////////////////
-// Peek at current FIFO node
+  for (size_t color=0; color<info->num_colors; ++color) {
 
-const tree_node_t* fifo_peek(const queue_t* q) {
-  assert(!fifo_empty(q));
-  return q->fifo.start[q->fifo.next];
-}
+    if (state->completed & (1 << color)) { continue; }
 
-//////////////////////////////////////////////////////////////////////
-// Dequeue node from FIFO
+    pos_t cur_pos = state->pos[color];
 
-tree_node_t* fifo_deque(queue_t* q) {
-  assert(!fifo_empty(q));
-  return q->fifo.start[q->fifo.next++];
-}
+    bitboard_t cur_bits, goal_bits, behind = trail[color];
+    memset(&cur_bits, 0, sizeof(cur_bits));
+    memset(&goal_bits, 0, sizeof(goal_bits));
 
-//////////////////////////////////////////////////////////////////////
-// De-allocate storage for FIFO
+    bitboard_set(&cur_bits, cur_pos);
+    bitboard_set(&goal_bits, state->tail[color]);
+    behind.words[cur_pos >> 6] &= ~((uint64_t)1 << (cur_pos & 63));
 
-void fifo_destroy(queue_t* q) {
-  free(q->fifo.start);
-}
+    bitboard_t cur_near = bitboard_dilate(&cur_bits);
+    bitboard_t goal_near = bitboard_dilate(&goal_bits);
+    bitboard_t behind_near = bitboard_dilate(&behind);
+    bitboard_t trail_near = bitboard_dilate(&trail[color]);
 
-//////////////////////////////////////////////////////////////////////
-// Call this before calling the generic queue functions above.
+    bitboard_t allowed, from_cur, frontier;
 
-void queue_setup() {
+    for (int i=0; i<4; ++i) {
+      // Cells we could move to right now (see game_can_move)
+      first[color].words[i] = (cur_near.words[i] & free.words[i] &
+                               ~behind_near.words[i]);
+      // Cells we could move to later
+      allowed.words[i] = free.words[i] & ~trail_near.words[i];
+    }
 
-  if (g_options.search_best_first) {
+    // Flood fill from the current position
+    from_cur = frontier = first[color];
 
-    queue_create = heapq_create;
-    queue_enqueue = heapq_enqueue;
-    queue_deque = heapq_deque;
-    queue_destroy = heapq_destroy;
-    queue_empty = heapq_empty;
-    queue_peek = heapq_peek;
+    while (!bitboard_empty(&frontier)) {
+      bitboard_t next = bitboard_dilate(&frontier);
+      for (int i=0; i<4; ++i) {
+        frontier.words[i] = next.words[i] & allowed.words[i] & ~from_cur.words[i];
+        from_cur.words[i] |= frontier.words[i];
+      }
+    }
 
-  } else {
+    int reached = 0;
 
-    queue_create = fifo_create;
-    queue_enqueue = fifo_enqueue;
-    queue_deque = fifo_deque;
-    queue_destroy = fifo_destroy;
-    queue_empty = fifo_empty;
-    queue_peek = fifo_peek;
+    for (int i=0; i<4; ++i) {
+      if (from_cur.words[i] & goal_near.words[i]) { reached = 1; }
+    }
 
+    if (reached) {
+      domains[color] = from_cur;
+    } else if (g_options.node_check_touch ||
+               !bitboard_test(&cur_near, state->tail[color])) {
+      // Without the touch test, a color next to its goal is done.
+      return 1;
+    }
+    
   }
 
+  return 0;
+
 }
 
 //////////////////////////////////////////////////////////////////////
-// Create a node from the linear allocator. This does not properly set
-// the cost to come and cost to go, those need to be finished later by
-// node_update_costs.
+// Get the domain of a cell: a bit flag for every color whose domain
+// includes it.
 
-tree_node_t* node_create(node_storage_t* storage,
-                         tree_node_t* parent,
-                         const game_info_t* info,
-                         const game_state_t* state) {
-  
-  tree_node_t* rval = node_storage_alloc(storage);
-  if (!rval) { return 0; }
+uint16_t game_cell_domain(const game_info_t* info,
+                          const bitboard_t domains[MAX_COLORS],
+                          pos_t pos) {
 
-  rval->parent = parent;
-  rval->cost_to_come = 0;
-  rval->cost_to_go = 0;
+  uint16_t rval = 0;
 
-  memcpy(&(rval->state), state, sizeof(game_state_t));
-  
-  return rval;
+  for (size_t color=0; color<info->num_colors; ++color) {
+    if (bitboard_test(&domains[color], pos)) {
+      rval |= (1 << color);
+    }
+  }
 
+  return rval;
+  
 }
 
 //////////////////////////////////////////////////////////////////////
-// Update the cost-to-come and cost-to-go for a node after a
-// successful move has been made.
+// Make sure every active color can reach its goal and that every free
+// cell has a non-empty domain. Also look for a move forced by the
+// domains: a cell next to the current position of a color that only
+// that color can fill must be filled by it right now, since later on
+// it would touch the path. If one is found, *forced_color is set to
+// it, otherwise to -1.
 
-void node_update_costs(const game_info_t* info,
-                       tree_node_t* n,
-                       size_t action_cost) {
+int game_check_domains(const game_info_t* info,
+                       const game_state_t* state,
+                       int* forced_color,
+                       int* forced_dir) {
 
-  // update cost to come
-  if (n->parent) {
- 
-    n->cost_to_come = n->parent->cost_to_come + action_cost;
+  bitboard_t domains[MAX_COLORS];
+  bitboard_t first[MAX_COLORS];
 
-  } else {
+  *forced_color = -1;
 
-    n->cost_to_come = 0;
+  if (game_build_domains(info, state, domains, first)) {
+    return 1;
+  }
+
+  bitboard_t filled;
+  memset(&filled, 0, sizeof(filled));
 
+  for (size_t color=0; color<info->num_colors; ++color) {
+    for (int i=0; i<4; ++i) {
+      filled.words[i] |= domains[color].words[i];
+    }
   }
   
-  n->cost_to_go = n->state.num_free;
-  
-}
-
-//////////////////////////////////////////////////////////////////////
-// Animate the solution by printing out boards in reverse order,
-// following parent pointers back from solution to root.
+  bitboard_t free = game_free_bits(info, state);
 
-void game_animate_solution(const game_info_t* info,
-                           const tree_node_t* node) {
+  for (int i=0; i<4; ++i) {
+    if (free.words[i] & ~filled.words[i]) {
+      return 1;
+    }
+  }
 
-  if (node->parent) {
-    game_animate_solution(info, node->parent);
+  if (!g_options.node_check_touch) {
+    return 0;
   }
 
-  printf("%s", unprint_board(info));
-  game_print(info, &node->state);
-  fflush(stdout);
+  for (size_t i=0; i<info->num_colors; ++i) {
 
-  delay_seconds(0.1);
-  
-}
+    size_t color = info->color_order[i];
 
-//////////////////////////////////////////////////////////////////////
-// Return free if in bounds and unoccupied
+    if (state->completed & (1 << color)) { continue; }
 
-int game_is_free(const game_info_t* info,
-                 const game_state_t* state,
-                 int x, int y) {
+    for (int dir=0; dir<4; ++dir) {
+      pos_t neighbor_pos = pos_offset_pos(info, state->pos[color], dir);
+      if (neighbor_pos != INVALID_POS &&
+          bitboard_test(&first[color], neighbor_pos) &&
+          game_cell_domain(info, domains, neighbor_pos) == (1 << color)) {
+        *forced_color = color;
+        *forced_dir = dir;
+        return 0;
+      }
+    }
+    
+  }
+
+  return 0;
 
-  return (coords_valid(info, x, y) &&
-          state->cells[pos_from_coords(x, y)] == 0);
-  
 }
 
 //////////////////////////////////////////////////////////////////////
-// This is a helper function used by game_check_bottleneck below.  If
-// the given color moves n steps, it will split a region of
-// freespace. Check to see how many colors would be unsolvable if this
-// occurred. If the number is greater than n, we have a problem!
-
-int game_check_chokepoint(const game_info_t* info,
-                          const game_state_t* state,
-                          int color, int dir, int n) {
-
-  // Make the proposed move.
-  game_state_t state_copy = *state;
+// Print connected components of freespace
+                        
+void game_print_regions(const game_info_t* info,
+                        const game_state_t* state,
+                        uint8_t rmap[MAX_CELLS]) {
 
-  for (int i=0; i<n; ++i) {
-    /*
-    game_print(info, &state_copy);
-    printf("trying to move step %d/%d %s\n", i+1, n+1,
-           color_cell_str(info, cell_create(TYPE_PATH, color, dir)));
-    assert( state_copy.cells[pos_offset_pos(info, state_copy.pos[color], dir)] == 0 );
-    */
-    game_make_move(info, &state_copy, color, dir, 1);
+  printf("%s", BLOCK_CHAR);
+  for (size_t x=0; x<info->size; ++x) {
+    printf("%s", BLOCK_CHAR);
   }
+  printf("%s\n", BLOCK_CHAR);
 
-  // Build new region map
-  uint8_t rmap[MAX_CELLS];
-  size_t rcount = game_build_regions(info, &state_copy, rmap);
-
-  // See if we are stranded 
-  int result = game_regions_stranded(info, &state_copy, rcount, rmap,
-                                     color, n+1);
+  for (size_t y=0; y<info->size; ++y) {
+    printf("%s", BLOCK_CHAR);
+    for (size_t x=0; x<info->size; ++x) {
+      pos_t pos = pos_from_coords(x, y);
+      pos_t rid = rmap[pos];
+      const color_lookup_t* l = &color_dict[rid % MAX_COLORS];
+      if (!state->cells[pos]) {
+        assert(rid != INVALID_POS);
+        char c = 65 + rid % 60;
+        printf("%s", color_char(l->ansi_code, c, c));
+      } else {
+        assert(rid == INVALID_POS);
+        printf(" ");
+      }
+    }
+    printf("%s\n", BLOCK_CHAR);
+  }
 
-  if (result) {
-    return result;
+  printf("%s", BLOCK_CHAR);
+  for (size_t x=0; x<info->size; ++x) {
+    printf("%s", BLOCK_CHAR);
   }
+  printf("%s\n", BLOCK_CHAR);
+  
+  printf("\n");
   
-  return 0;
-
 }
 
 //////////////////////////////////////////////////////////////////////
-// Identify bottlenecks -- narrow regions -- created by a recent move
-// of a color, then see if it renders the puzzle unsolvable.
-
-int game_check_bottleneck(const game_info_t* info,
-                          const game_state_t* state) {
-
-  size_t color = state->last_color;
+// Helper function for game_find_forced below -- is the free cell at
+// pos forced to be filled from the given end of a color?
 
-  if (color >= info->num_colors) { return 0; }
+int game_is_forced(const game_info_t* info,
+                   const game_state_t* state,
+                   int color, pos_t end_pos, pos_t pos) {
 
-  pos_t pos = state->pos[color];
-  
-  int x0, y0;
-  pos_get_coords(pos, &x0, &y0);
+  int num_free = 0;
+  int num_other_endpoints = 0;
 
   for (int dir=0; dir<4; ++dir) {
-
-    int dx = DIR_DELTA[dir][0];
-    int dy = DIR_DELTA[dir][1];
-
-    int x1 = x0+dx;
-    int y1 = y0+dy;
-
-    if (game_is_free(info, state, x1, y1)) {
-      for (int n=0; n<g_options.node_bottleneck_limit; ++n) {
-        int x2 = x1+dx;
-        int y2 = y1+dy;
-        if (!game_is_free(info, state, x2, y2)) {
-          int r = game_check_chokepoint(info, state, color, dir, n+1);
-          if (r) { return r; }
-          break;
+    pos_t neighbor_pos = pos_offset_pos(info, pos, dir);
+    if (neighbor_pos == INVALID_POS ||
+        neighbor_pos == end_pos) {
+      continue;
+    } else if (state->cells[neighbor_pos] == 0) {
+      ++num_free;
+    } else {
+      for (size_t other_color=0; other_color<info->num_colors; ++other_color) {
+        if (other_color == color) { continue; }
+        if (state->completed & (1 << other_color)) { continue; }
+        if (neighbor_pos == state->pos[other_color] ||
+            neighbor_pos == state->tail[other_color]) {
+          ++num_other_endpoints;
         }
-        x1 = x2;
-        y1 = y2;
       }
-    }
-    
-  }
+    } 
+  } // for each neighbor
 
-  return 0;
+  return (num_free == 1 && num_other_endpoints == 0);
 
 }
-
+                                         
 //////////////////////////////////////////////////////////////////////
-// Perform diagnostics on the given node
+// Find a forced move. This could be optimized to not search all
+// colors all the time, maybe? If forced_end is non-null and paths can
+// grow from both ends, tails are considered too, and *forced_end is
+// set to 1 if the move is from the tail (see game_swap_ends).
+
+int game_find_forced(const game_info_t* info,
+                     const game_state_t* state,
+                     int* forced_color,
+                     int* forced_dir,
+                     int* forced_end) {
+
+  // if there is a freespace next to an endpoint and the freespace has
+  // only one free neighbor, we must extend the endpoint into it.
+
+  int num_ends = (forced_end && g_options.search_both_ends) ? 2 : 1;
+
+  for (size_t i=0; i<info->num_colors*num_ends; ++i) {
+
+    size_t color = info->color_order[i % info->num_colors];
+    int end = i / info->num_colors;
+
+    if (state->completed & (1 << color)) { continue; }
+
+      pos_t end_pos = end ? state->tail[color] : state->pos[color];
+
+      int free_dir = -1;
+      int num_free = 0;
+
+      for (int dir=0; dir<4; ++dir) {
+
+        pos_t neighbor_pos = pos_offset_pos(info, end_pos, dir);
+        if (neighbor_pos == INVALID_POS) { continue; }
+
+        if (state->cells[neighbor_pos] == 0) {
+
+          free_dir = dir;
+          ++num_free;
+
+          if (game_is_forced(info, state, color, end_pos, neighbor_pos)) {
+
+            *forced_color = color;
+            *forced_dir = dir;
+
+            if (forced_end) { *forced_end = end; }
+
+            return 1;
+
+          }
+
+        }
+
+      } // for each neighbor      
+
+  }
+
+  return 0;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// After a move, keep extending the same color as long as it has
+// exactly one legal move, so a whole corridor gets taken as a single
+// macro-move instead of one search node per cell. That is safe since
+// the color has to make that move sooner or later anyways. Dead ends
+// are checked after each step. Returns the combined action cost, or
+// -1 if the state should be pruned. If hint is non-null, the hint
+// penalty of every cell the corridor fills is added to *hint_cost.
+
+int game_follow_corridor(const game_info_t* info,
+                         game_state_t* state,
+                         int color,
+                         const hint_t* hint,
+                         double* hint_cost) {
+
+  int total_cost = 0;
+
+  while (!(state->completed & (1 << color))) {
+
+    int move_dir = -1;
+    
+    for (int dir=0; dir<4; ++dir) {
+      if (game_can_move(info, state, color, dir)) {
+        if (move_dir >= 0) { return total_cost; }
+        move_dir = dir;
+      }
+    }
+
+    if (move_dir < 0) {
+      return -1;
+    }
+
+    if (hint) {
+      pos_t next_pos = pos_offset_pos(info, state->pos[color], move_dir);
+      if (!state->cells[next_pos]) {
+        *hint_cost += hint->penalty[next_pos][color];
+      }
+    }
+
+    total_cost += game_make_move(info, state, color, move_dir, 0);
+
+    if (g_options.node_check_deadends &&
+        game_check_deadends(info, state)) {
+      return -1;
+    }
+    
+  }
+
+  return total_cost;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Create simple linear allocator for search nodes.
+
+node_storage_t node_storage_create(size_t max_nodes) {
+
+  node_storage_t storage;
+  
+  storage.start = malloc(max_nodes*sizeof(tree_node_t));
+  
+  if (!storage.start) {
+    fprintf(stderr, "unable to allocate memory for node storage!\n");
+    exit(1);
+  }
+
+  storage.capacity = max_nodes;
+  storage.count = 0;
+
+  return storage;
+    
+}
+
+//////////////////////////////////////////////////////////////////////
+// Allocate the next tree node.
+
+tree_node_t* node_storage_alloc(node_storage_t* storage) {
+  if (storage->count >= storage->capacity) {
+    return NULL;
+  }
+  tree_node_t* rval = storage->start + storage->count;
+  ++storage->count;
+  return rval;
+}
+
+//////////////////////////////////////////////////////////////////////
+// De-allocate a tree node -- note that we can only safely de-allocate
+// the last node that was allocated. Of course we only check this with
+// an assert, tho.
+
+void node_storage_unalloc(node_storage_t* storage,
+                          const tree_node_t* n) {
+
+  assert( storage->count && n == storage->start + storage->count - 1 );
+  --storage->count;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Free the memory allocated for this.
+
+void node_storage_destroy(node_storage_t* storage) {
+  free(storage->start);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Compare total cost for nodes, used by heap functions below. A
+// weight above 1 inflates the cost to go (weighted A*).
+
+int node_compare(const tree_node_t* a,
+                 const tree_node_t* b,
+                 double weight) {
+
+  double af = a->cost_to_come + weight * a->cost_to_go;
+  double bf = b->cost_to_come + weight * b->cost_to_go;
+
+  if (af != bf) {
+    return af < bf ? -1 : 1;
+  } else {
+    return a < b ? -1 : 1;
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Create a binary heap to store the given # of nodes
+
+queue_t heapq_create(size_t max_nodes) {
+  queue_t rval;
+  rval.heapq.start = malloc(sizeof(tree_node_t*) * max_nodes);
+  if (!rval.heapq.start) {
+    fprintf(stderr, "out of memory creating heapq!\n");
+    exit(1);
+  }
+  rval.heapq.count = 0;
+  rval.heapq.capacity = max_nodes;
+  rval.heapq.weight = g_options.search_weight;
+  return rval;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Indexing macros for heaps
+
+#define HEAPQ_PARENT_INDEX(i) (((i)-1)/2)
+#define HEAPQ_LCHILD_INDEX(i) ((2*(i))+1)
+
+//////////////////////////////////////////////////////////////////////
+// For debugging, not used presently
+
+int heapq_valid(const queue_t* q) {
+  for (size_t i=1; i<q->heapq.count; ++i) {
+    const tree_node_t* tc = q->heapq.start[i];
+    const tree_node_t* tp = q->heapq.start[HEAPQ_PARENT_INDEX(i)];
+    if (node_compare(tp, tc, q->heapq.weight) > 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Is heap queue empty?
+
+int heapq_empty(const queue_t* q) {
+  return q->heapq.count == 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Peek at the next item to be removed
+
+const tree_node_t* heapq_peek(const queue_t* q) {
+  assert(!heapq_empty(q));
+  return q->heapq.start[0];
+}
+
+//////////////////////////////////////////////////////////////////////
+// Enqueue a node onto the heap
+
+void heapq_enqueue(queue_t* q, tree_node_t* node) {
+
+  assert(q->heapq.count < q->heapq.capacity);
+
+  size_t i = q->heapq.count++;
+  size_t pi = HEAPQ_PARENT_INDEX(i);
+  
+  q->heapq.start[i] = node;
+  
+  while (i > 0 && node_compare(q->heapq.start[pi], q->heapq.start[i],
+                                  q->heapq.weight) > 0) {
+    tree_node_t* tmp = q->heapq.start[pi];
+    q->heapq.start[pi] = q->heapq.start[i];
+    q->heapq.start[i] = tmp;
+    i = pi;
+    pi = HEAPQ_PARENT_INDEX(i);
+  }
+                      
+}
+
+//////////////////////////////////////////////////////////////////////
+// Helper function used for dequeueing
+
+void _heapq_repair(queue_t* q, size_t i) {
+
+  size_t li = HEAPQ_LCHILD_INDEX(i);
+  size_t ri = li + 1;
+  size_t smallest = i;
+
+  if (li < q->heapq.count &&
+      node_compare(q->heapq.start[i], q->heapq.start[li],
+                   q->heapq.weight) > 0) {
+    smallest = li;
+  }
+
+  if (ri < q->heapq.count &&
+      node_compare(q->heapq.start[smallest], q->heapq.start[ri],
+                   q->heapq.weight) > 0) {
+    smallest = ri;
+  }
+
+  if (smallest != i){
+    tree_node_t* tmp = q->heapq.start[i];
+    q->heapq.start[i] = q->heapq.start[smallest];
+    q->heapq.start[smallest] = tmp;
+    _heapq_repair(q, smallest);
+  }    
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Pop a node off the heap
+
+tree_node_t* heapq_deque(queue_t* q) {
+
+  assert(!heapq_empty(q));
+
+  tree_node_t* rval = q->heapq.start[0];
+  --q->heapq.count;
+
+  if (q->heapq.count) {
+    q->heapq.start[0] = q->heapq.start[q->heapq.count];
+    _heapq_repair(q, 0);
+  }
+  
+  return rval;
+  
+}
+
+//////////////////////////////////////////////////////////////////////
+// Change the weight on cost to go and restore the heap property
+// in place, so the nodes already queued are kept.
+
+void heapq_reweight(queue_t* q, double weight) {
+
+  q->heapq.weight = weight;
+
+  for (size_t i=q->heapq.count/2; i-- > 0; ) {
+    _heapq_repair(q, i);
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Remove everything from the heap, keeping its memory
+
+void heapq_clear(queue_t* q) {
+  q->heapq.count = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Free memory allocated for heap
+
+void heapq_destroy(queue_t* q) {
+  free(q->heapq.start);
+}
+
+//////////////////////////////////////////////////////////////////////
+// FIFO via flat array
+
+queue_t fifo_create(size_t max_nodes) {
+  queue_t rval;
+  rval.fifo.start = malloc(sizeof(tree_node_t*) * max_nodes);
+  if (!rval.fifo.start) {
+    fprintf(stderr, "out of memory creating fifo!\n");
+    exit(1);
+  }
+  rval.fifo.count = 0;
+  rval.fifo.capacity = max_nodes;
+  rval.fifo.next = 0;
+  return rval;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Check if empty
+
+int fifo_empty(const queue_t* q) {
+  return q->fifo.next == q->fifo.count;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Push node into FIFO
+
+void fifo_enqueue(queue_t* q, tree_node_t* n) {
+  assert(q->fifo.count < q->fifo.capacity);
+  q->fifo.start[q->fifo.count++] = n;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Peek at current FIFO node
+
+const tree_node_t* fifo_peek(const queue_t* q) {
+  assert(!fifo_empty(q));
+  return q->fifo.start[q->fifo.next];
+}
+
+//////////////////////////////////////////////////////////////////////
+// Dequeue node from FIFO
+
+tree_node_t* fifo_deque(queue_t* q) {
+  assert(!fifo_empty(q));
+  return q->fifo.start[q->fifo.next++];
+}
+
+//////////////////////////////////////////////////////////////////////
+// Remove everything from the FIFO, keeping its memory
+
+void fifo_clear(queue_t* q) {
+  q->fifo.count = 0;
+  q->fifo.next = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// De-allocate storage for FIFO
+
+void fifo_destroy(queue_t* q) {
+  free(q->fifo.start);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Call this before calling the generic queue functions above.
+
+void queue_setup() {
+
+  if (g_options.search_best_first) {
+
+    queue_create = heapq_create;
+    queue_enqueue = heapq_enqueue;
+    queue_deque = heapq_deque;
+    queue_destroy = heapq_destroy;
+    queue_clear = heapq_clear;
+    queue_empty = heapq_empty;
+    queue_peek = heapq_peek;
+
+  } else {
+
+    queue_create = fifo_create;
+    queue_enqueue = fifo_enqueue;
+    queue_deque = fifo_deque;
+    queue_destroy = fifo_destroy;
+    queue_clear = fifo_clear;
+    queue_empty = fifo_empty;
+    queue_peek = fifo_peek;
+
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Make an empty queue of the type chosen by queue_setup out of an
+// array of node pointers that the caller owns.
+
+queue_t queue_wrap(tree_node_t** start, size_t capacity) {
+
+  queue_t rval;
+
+  if (g_options.search_best_first) {
+    rval.heapq.start = start;
+    rval.heapq.capacity = capacity;
+    rval.heapq.count = 0;
+    rval.heapq.weight = g_options.search_weight;
+  } else {
+    rval.fifo.start = start;
+    rval.fifo.capacity = capacity;
+    rval.fifo.count = 0;
+    rval.fifo.next = 0;
+  }
+
+  return rval;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Get empty node storage and queue for a search of up to max_nodes
+// nodes. The memory is only allocated when a search needs more of it
+// than the ones before, and stays around for the next one.
+
+void search_memory_get(size_t max_nodes,
+                       node_storage_t* storage,
+                       queue_t* q) {
+
+  if (g_search_storage.capacity < max_nodes) {
+
+    node_storage_destroy(&g_search_storage);
+    free(g_search_queue);
+
+    g_search_storage = node_storage_create(max_nodes);
+    g_search_queue = malloc(sizeof(tree_node_t*) * max_nodes);
+
+    if (!g_search_queue) {
+      fprintf(stderr, "out of memory creating queue!\n");
+      exit(1);
+    }
+
+  }
+
+  storage->start = g_search_storage.start;
+  storage->capacity = max_nodes;
+  storage->count = 0;
+
+  *q = queue_wrap(g_search_queue, max_nodes);
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Free the memory kept by search_memory_get.
+
+void search_memory_free() {
+
+  node_storage_destroy(&g_search_storage);
+  free(g_search_queue);
+
+  memset(&g_search_storage, 0, sizeof(g_search_storage));
+  g_search_queue = 0;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Create a node from the linear allocator. This does not properly set
+// the cost to come and cost to go, those need to be finished later by
+// node_update_costs.
+
+tree_node_t* node_create(node_storage_t* storage,
+                         tree_node_t* parent,
+                         const game_info_t* info,
+                         const game_state_t* state) {
+  
+  tree_node_t* rval = node_storage_alloc(storage);
+  if (!rval) { return 0; }
+
+  rval->parent = parent;
+  rval->expansions = 0;
+  rval->cost_to_come = 0;
+  rval->cost_to_go = 0;
+
+  memcpy(&(rval->state), state, sizeof(game_state_t));
+  
+  return rval;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Estimate the cost to go for a game state. Every free cell must
+// still be filled, so all heuristics start from the free count. The
+// others add terms from region analysis to tell apart states with the
+// same number of free cells, and are not admissible: the cells on a
+// color's shortest path are free cells already counted once, and a
+// region with several candidate colors costs nothing extra to fill.
+
+double game_heuristic(const game_info_t* info,
+                      const game_state_t* state) {
+
+  double cost_to_go = state->num_free;
+
+  if (g_options.search_heuristic == HEURISTIC_DIST) {
+
+    bitboard_t free = game_free_bits(info, state);
+
+    // Penalize heads that are far from their goals -- each step
+    // beyond the first needs a free cell.
+    for (size_t color=0; color<info->num_colors; ++color) {
+      if (!(state->completed & (1 << color))) {
+        cost_to_go += game_color_distance(info, state, &free, color) - 1;
+      }
+    }
+
+  } else if (g_options.search_heuristic == HEURISTIC_REGIONS) {
+
+    uint8_t rmap[MAX_CELLS];
+    size_t rcount = game_build_regions(info, state, rmap);
+
+    uint16_t cur_rflags[MAX_CELLS];
+    uint16_t goal_rflags[MAX_CELLS];
+
+    memset(cur_rflags, 0, rcount*sizeof(uint16_t));
+    memset(goal_rflags, 0, rcount*sizeof(uint16_t));
+
+    for (size_t color=0; color<info->num_colors; ++color) {
+      uint16_t cflag = (1 << color);
+      if (!(state->completed & cflag)) {
+        game_regions_add_color(info, state, rmap, state->pos[color],
+                               cflag, cur_rflags);
+        game_regions_add_color(info, state, rmap, state->tail[color],
+                               cflag, goal_rflags);
+      }
+    }
+
+    // Penalize regions that more than one color could fill, since
+    // the search still has to decide between them.
+    for (size_t r=0; r<rcount; ++r) {
+      int candidates = __builtin_popcount(cur_rflags[r] & goal_rflags[r]);
+      if (candidates > 1) {
+        cost_to_go += candidates - 1;
+      }
+    }
+
+  }
+
+  return cost_to_go;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Update the cost-to-come and cost-to-go for a node after a
+// successful move has been made.
+
+void node_update_costs(const game_info_t* info,
+                       tree_node_t* n,
+                       double action_cost) {
+
+  // update cost to come
+  if (n->parent) {
+ 
+    n->cost_to_come = n->parent->cost_to_come + action_cost;
+
+  } else {
+
+    n->cost_to_come = 0;
+
+  }
+  
+  n->cost_to_go = game_heuristic(info, &n->state);
+  
+}
+
+//////////////////////////////////////////////////////////////////////
+// For partial expansion (PEA*), decide whether a freshly generated
+// child should be stored during this expansion of its parent. On the
+// first expansion, children no costlier than the parent are kept;
+// afterwards, only children whose cost matches the parent's raised
+// cost are. Costs weight the cost to go the same way the queue does.
+// Deferred children lower *next_cost to their total cost so the
+// parent can be re-queued with it.
+
+int node_partial_keep(const tree_node_t* parent,
+                      const tree_node_t* child,
+                      double weight,
+                      double* next_cost) {
+
+  double parent_cost = parent->cost_to_come + weight * parent->cost_to_go;
+  double child_cost = child->cost_to_come + weight * child->cost_to_go;
+
+  if (child_cost > parent_cost) {
+    if (child_cost < *next_cost) { *next_cost = child_cost; }
+    return 0;
+  }
+
+  return !parent->expansions || child_cost == parent_cost;
+  
+}
+
+//////////////////////////////////////////////////////////////////////
+// Animate the solution by printing out boards in reverse order,
+// following parent pointers back from solution to root.
+
+void game_animate_solution(const game_info_t* info,
+                           const tree_node_t* node) {
+
+  if (node->parent) {
+    game_animate_solution(info, node->parent);
+  }
+
+  printf("%s", unprint_board(info));
+  game_print(info, &node->state);
+  fflush(stdout);
+
+  delay_seconds(0.1);
+  
+}
+
+//////////////////////////////////////////////////////////////////////
+// Return free if in bounds and unoccupied
+
+int game_is_free(const game_info_t* info,
+                 const game_state_t* state,
+                 int x, int y) {
+
+  return (coords_valid(info, x, y) &&
+          state->cells[pos_from_coords(x, y)] == 0);
+  
+}
+
+//////////////////////////////////////////////////////////////////////
+// This is a helper function used by game_check_bottleneck below.  If
+// the given color moves n steps, it will split a region of
+// freespace. Check to see how many colors would be unsolvable if this
+// occurred. If the number is greater than n, we have a problem!
+
+int game_check_chokepoint(const game_info_t* info,
+                          const game_state_t* state,
+                          int color, int dir, int n) {
+
+  // Make the proposed move.
+  game_state_t state_copy = *state;
+
+  for (int i=0; i<n; ++i) {
+    /*
+    game_print(info, &state_copy);
+    printf("trying to move step %d/%d %s\n", i+1, n+1,
+           color_cell_str(info, cell_create(TYPE_PATH, color, dir)));
+    assert( state_copy.cells[pos_offset_pos(info, state_copy.pos[color], dir)] == 0 );
+    */
+    game_make_move(info, &state_copy, color, dir, 1);
+  }
+
+  // Build new region map
+  uint8_t rmap[MAX_CELLS];
+  size_t rcount = game_build_regions(info, &state_copy, rmap);
+
+  // See if we are stranded 
+  int result = game_regions_stranded(info, &state_copy, rcount, rmap,
+                                     color, n+1);
+
+  if (result) {
+    return result;
+  }
+  
+  return 0;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Identify bottlenecks -- narrow regions -- created by a recent move
+// of a color, then see if it renders the puzzle unsolvable.
+
+int game_check_bottleneck(const game_info_t* info,
+                          const game_state_t* state) {
+
+  size_t color = state->last_color;
+
+  if (color >= info->num_colors) { return 0; }
+
+  pos_t pos = state->pos[color];
+  
+  int x0, y0;
+  pos_get_coords(pos, &x0, &y0);
+
+  for (int dir=0; dir<4; ++dir) {
+
+    int dx = DIR_DELTA[dir][0];
+    int dy = DIR_DELTA[dir][1];
+
+    int x1 = x0+dx;
+    int y1 = y0+dy;
+
+    if (game_is_free(info, state, x1, y1)) {
+      for (int n=0; n<g_options.node_bottleneck_limit; ++n) {
+        int x2 = x1+dx;
+        int y2 = y1+dy;
+        if (!game_is_free(info, state, x2, y2)) {
+          int r = game_check_chokepoint(info, state, color, dir, n+1);
+          if (r) { return r; }
+          break;
+        }
+        x1 = x2;
+        y1 = y2;
+      }
+    }
+    
+  }
+
+  return 0;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Perform diagnostics on the given node
 
 void game_diagnostics(const game_info_t* info,
                    const tree_node_t* node) {
 
-  printf("\n###################################"
-         "###################################\n\n");
+  printf("\n###################################"
+         "###################################\n\n");
+
+  printf("node has cost to come %'g and cost to go %'g\n",
+         node->cost_to_come, node->cost_to_go);
+
+  if (node->state.last_color < info->num_colors) {
+    printf("last move was for color %s\n",
+           color_name_str(info, node->state.last_color));
+
+  } else {
+    printf("no moves yet?\n");
+  }
+
+  game_state_t state_copy = node->state;
+
+  int forced = 1;
+  
+  while (forced) {
+
+    printf("game state:\n\n");
+    game_print(info, &state_copy);
+    printf("\n");
+    
+    uint8_t rmap[MAX_CELLS];
+
+    size_t rcount = game_build_regions(info, &state_copy, rmap);
+
+    if (game_check_deadends(info, &state_copy)) {
+      printf("dead-ended -- state should be pruned!\n");
+      printf("game regions:\n\n");
+      game_print_regions(info, &state_copy, rmap);
+      break;
+    }
+    
+    if (game_regions_stranded(info, &state_copy, rcount, rmap, MAX_COLORS, 1)) {
+      printf("stranded -- state should be pruned!\n");
+      printf("game regions:\n\n");
+      game_print_regions(info, &state_copy, rmap);
+      break;
+    }
+
+    int r = game_check_bottleneck(info, &state_copy);
+    if (r) {
+      printf("chokepoint for ");
+      for (size_t color=0; color<info->num_colors; ++color) {
+        if (r & (1 << color)) {
+          printf("%s", color_name_str(info, color));
+        }
+      }
+      printf(" -- state should be pruned!\n");
+      break;
+    }
+
+    int color, dir, end;
+    forced = game_find_forced(info, &state_copy,
+                              &color, &dir, &end);
+    
+    if (forced) {
+
+      if (end) {
+        game_swap_ends(&state_copy, color);
+      }
+
+      cell_t move = cell_create(TYPE_PATH, color, dir);
+
+      printf("color %s is forced to move %s\n",
+             color_name_str(info, color),
+             color_cell_str(info, move));
+
+      if (!game_can_move(info, &state_copy, color, dir)) {
+        printf("...but it is not allowed -- state should be pruned!\n");
+        break;
+      }
+
+      game_make_move(info, &state_copy, color, dir, 1);
+      
+    }
+    
+  }
+  
+}
+
+//////////////////////////////////////////////////////////////////////
+// Record the time taken by a node check, and whether it pruned the
+// node. Returns the result of the check.
+
+int search_stats_record(search_stats_t* stats,
+                        int check, double start,
+                        int result) {
+
+  stats->check_time[check] += now() - start;
+
+  if (result) {
+    ++stats->pruned[check];
+  }
+
+  return result;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Add the statistics from a sub-search into the totals.
+
+void search_stats_add(search_stats_t* stats,
+                      const search_stats_t* other) {
+
+  for (int i=0; i<NUM_CHECKS; ++i) {
+    stats->check_time[i] += other->check_time[i];
+    stats->pruned[i] += other->pruned[i];
+  }
+
+  stats->requeued += other->requeued;
+  stats->splits += other->splits;
+  stats->subsearch_nodes += other->subsearch_nodes;
+  stats->restarts += other->restarts;
+  stats->nogoods_stored += other->nogoods_stored;
+  stats->nogoods_pruned += other->nogoods_pruned;
+  stats->symmetric_pruned += other->symmetric_pruned;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Print how many solutions a search counted.
+
+void search_print_count(const search_stats_t* stats) {
+
+  printf("found %s%'zu solution%s\n",
+         stats->solutions_exact ? "exactly " : "at least ",
+         stats->solutions, stats->solutions == 1 ? "" : "s");
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Record how far an anytime search got with the given weight.
+
+void search_stats_round(search_stats_t* stats,
+                        const node_storage_t* storage,
+                        double weight, double cost, double start) {
+
+  if (stats->num_rounds < MAX_ROUNDS) {
+    search_round_t* round = stats->rounds + stats->num_rounds++;
+    round->weight = weight;
+    round->cost = cost;
+    round->elapsed = now() - start;
+    round->nodes = storage->count + stats->subsearch_nodes;
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Run the enabled node checks from the given groups (CHECKS_CHEAP,
+// CHECKS_EXPENSIVE, or both) on a game state. Returns nonzero if the
+// state should be pruned. If forced_color is non-null, it is set to
+// the color of a move forced by the domain check, or -1 if none.
+
+int game_check_state(const game_info_t* info,
+                     const game_state_t* state,
+                     int checks,
+                     search_stats_t* stats,
+                     int* forced_color,
+                     int* forced_dir) {
+
+  int domain_color, domain_dir;
+
+  if (forced_color) {
+    *forced_color = -1;
+  }
+
+  if ((checks & CHECKS_CHEAP) && g_options.node_check_deadends) {
+    
+    double start = now();
+    
+    if (search_stats_record(stats, CHECK_DEADENDS, start,
+                            game_check_deadends(info, state))) {
+      return 1;
+    }
+    
+  }
+
+  if ((checks & CHECKS_EXPENSIVE) &&
+      (g_options.node_check_stranded || g_options.node_check_matching ||
+       g_options.node_check_parity || g_options.node_check_distance)) {
+
+    // Time to build regions counts towards the first check using them
+    double start = now();
+    
+    uint8_t rmap[MAX_CELLS];
+    size_t rcount = game_build_regions(info, state, rmap);
+
+    if (g_options.node_check_stranded &&
+        search_stats_record(stats, CHECK_STRANDED, start,
+                            game_regions_stranded(info, state, rcount, rmap,
+                                                  MAX_COLORS, 1))) {
+      return 1;
+    }
+
+    if (g_options.node_check_stranded) {
+      start = now();
+    }
+
+    if (g_options.node_check_matching &&
+        search_stats_record(stats, CHECK_MATCHING, start,
+                            game_regions_unmatched(info, state,
+                                                   rcount, rmap))) {
+      return 1;
+    }
+
+    if (g_options.node_check_stranded || g_options.node_check_matching) {
+      start = now();
+    }
+
+    if (g_options.node_check_parity &&
+        search_stats_record(stats, CHECK_PARITY, start,
+                            game_regions_parity(info, state,
+                                                rcount, rmap))) {
+      return 1;
+    }
+
+    if (g_options.node_check_stranded || g_options.node_check_matching ||
+        g_options.node_check_parity) {
+      start = now();
+    }
+
+    if (g_options.node_check_distance &&
+        search_stats_record(stats, CHECK_DISTANCE, start,
+                            game_check_distances(info, state, rcount, rmap))) {
+      return 1;
+    }
+
+  }
+
+  if ((checks & CHECKS_EXPENSIVE) && g_options.node_check_domains) {
+
+    double start = now();
+
+    if (search_stats_record(stats, CHECK_DOMAINS, start,
+                            game_check_domains(info, state,
+                                               &domain_color,
+                                               &domain_dir))) {
+      return 1;
+    }
+
+    if (forced_color) {
+      *forced_color = domain_color;
+      *forced_dir = domain_dir;
+    }
+    
+  }
+
+  if ((checks & CHECKS_EXPENSIVE) && g_options.node_bottleneck_limit) {
+
+    double start = now();
+
+    if (search_stats_record(stats, CHECK_BOTTLENECK, start,
+                            game_check_bottleneck(info, state))) {
+      return 1;
+    }
+    
+  }
+
+  return 0;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Fast-forward through any forced moves from the given node (which
+// must be the last one allocated), and run node checks on the
+// result. Returns the last node of the forced chain, or 0 (with the
+// chain de-allocated) if it should be pruned.
+
+tree_node_t* game_validate_ff(const game_info_t* info,
+                              tree_node_t* node,
+                              node_storage_t* storage,
+                              int checks,
+                              search_stats_t* stats) {
+
+  assert(node == storage->start+storage->count-1);
+  
+  const game_state_t* node_state = &node->state;
+
+  int fast_forward = (g_options.search_fast_forward &&
+                      g_options.order_forced_first);
+  
+  int color, dir, end = 0;
+
+  if (!fast_forward ||
+      !game_find_forced(info, node_state, &color, &dir, &end)) {
+
+    // Nothing forced yet, so check this node -- the domain check may
+    // turn up a forced move of its own.
+    if (game_check_state(info, node_state, checks, stats, &color, &dir)) {
+      goto unalloc_return_0;
+    }
+
+    if (!fast_forward || color < 0) {
+      return node;
+    }
+    
+  }
+
+  game_state_t swapped;
+
+  if (end) {
+    swapped = *node_state;
+    game_swap_ends(&swapped, color);
+    node_state = &swapped;
+  }
+
+  if (!game_can_move(info, node_state, color, dir)) {
+    goto unalloc_return_0;
+  }
+      
+  tree_node_t* forced_child = node_create(storage, node, info,
+                                          node_state);
+
+  // if null, we ran out of memory and returning node is fine.
+      
+  if (forced_child) {
+
+    game_make_move(info, &forced_child->state,
+                   color, dir, 1);
+
+    node_update_costs(info, forced_child, 0);
+    forced_child = game_validate_ff(info, forced_child, storage,
+                                    checks, stats);
+      
+    if (!forced_child) {
+      goto unalloc_return_0;
+    } else {
+      return forced_child;
+    }
+
+  }
+  
+  return node;
+
+ unalloc_return_0:
+
+  assert(node == storage->start+storage->count-1);
+  node_storage_unalloc(storage, node);
+  return 0;
+  
+}
+
+//////////////////////////////////////////////////////////////////////
+// Split a state into independent subproblems. Regions of free space
+// sharing an active color (touching its current or goal position)
+// belong to the same subproblem, as do the colors. Each subproblem
+// gets a sub-state where the colors of the other subproblems are
+// marked completed and their free cells are blocked off. Returns the
+// number of subproblems, or 0 if some region of free space touches no
+// active color and so can never get filled.
+
+size_t game_split_state(const game_info_t* info,
+                        const game_state_t* state,
+                        game_state_t substates[MAX_COLORS]) {
+
+  uint8_t rmap[MAX_CELLS];
+  size_t rcount = game_build_regions(info, state, rmap);
+
+  uint16_t rcolors[rcount];
+  memset(rcolors, 0, sizeof(rcolors));
+
+  uint16_t active = 0;
+
+  for (size_t color=0; color<info->num_colors; ++color) {
+    
+    uint16_t cflag = (1 << color);
+    if (state->completed & cflag) { continue; }
+
+    active |= cflag;
+
+    game_regions_add_color(info, state, rmap, state->pos[color],
+                           cflag, rcolors);
+    
+    game_regions_add_color(info, state, rmap, state->tail[color],
+                           cflag, rcolors);
+    
+  }
+
+  // Each region joins together the colors touching it.
+  uint16_t groups[MAX_COLORS];
+  size_t num_groups = 0;
+
+  for (size_t r=0; r<rcount; ++r) {
+
+    if (!rcolors[r]) { return 0; }
+
+    uint16_t merged = rcolors[r];
+    size_t g = 0;
+
+    while (g < num_groups) {
+      if (groups[g] & merged) {
+        merged |= groups[g];
+        groups[g] = groups[--num_groups];
+      } else {
+        ++g;
+      }
+    }
+
+    groups[num_groups++] = merged;
+    
+  }
+
+  // Colors touching no regions are on their own.
+  uint16_t grouped = 0;
+  
+  for (size_t g=0; g<num_groups; ++g) {
+    grouped |= groups[g];
+  }
+
+  for (size_t color=0; color<info->num_colors; ++color) {
+    if ((active & ~grouped) & (1 << color)) {
+      groups[num_groups++] = (1 << color);
+    }
+  }
+
+  if (num_groups < 2) {
+    return num_groups;
+  }
+
+  for (size_t g=0; g<num_groups; ++g) {
+
+    game_state_t* substate = substates + g;
+    *substate = *state;
+
+    uint16_t others = active & ~groups[g];
+    substate->completed |= others;
+
+    cell_t blocker = cell_create(TYPE_PATH, __builtin_ctz(others), 0);
+
+    for (size_t y=0; y<info->size; ++y) {
+      for (size_t x=0; x<info->size; ++x) {
+        pos_t pos = pos_from_coords(x, y);
+        if (rmap[pos] != INVALID_POS && !(rcolors[rmap[pos]] & groups[g])) {
+          substate->cells[pos] = blocker;
+          --substate->num_free;
+        }
+      }
+    }
+    
+  }
+
+  return num_groups;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Hash everything that decides whether a (sub)state can be solved:
+// its free cells, the ends of its unfinished colors, and the cells of
+// those colors next to free space, which the self-touch rule looks at.
+// Cells of other colors just count as blocked, so the same subproblem
+// gets the same signature no matter how the rest of the board looks.
+
+uint64_t game_signature(const game_info_t* info,
+                        const game_state_t* state) {
+
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  
+#define SIGNATURE_ADD(byte) hash = (hash ^ (uint8_t)(byte)) * 1099511628211ULL
+
+  bitboard_t free = game_free_bits(info, state);
+  bitboard_t near_free = bitboard_dilate(&free);
+
+  uint16_t active = ~state->completed & ((1 << info->num_colors) - 1);
+
+  for (size_t color=0; color<info->num_colors; ++color) {
+    if (active & (1 << color)) {
+      SIGNATURE_ADD(color);
+      SIGNATURE_ADD(state->pos[color]);
+      SIGNATURE_ADD(state->tail[color]);
+    }
+  }
+
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+      pos_t pos = pos_from_coords(x, y);
+      cell_t cell = state->cells[pos];
+      if (!cell) {
+        SIGNATURE_ADD(pos);
+      } else if ((active & (1 << cell_get_color(cell))) &&
+                 bitboard_test(&near_free, pos)) {
+        SIGNATURE_ADD(pos);
+        SIGNATURE_ADD(cell & ~0xc); // direction doesn't matter
+      }
+    }
+  }
+
+#undef SIGNATURE_ADD
+
+  // Zero marks empty slots
+  return hash ? hash : 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Is the signature in the nogood store?
+
+int game_nogood_find(uint64_t signature) {
+
+  for (size_t i=0; i<NOGOOD_MAX_PROBES; ++i) {
+    size_t slot = (signature + i) & (NOGOOD_STORE_SIZE - 1);
+    uint64_t stored = __atomic_load_n(g_nogoods + slot, __ATOMIC_RELAXED);
+    if (stored == signature) {
+      return 1;
+    } else if (!stored) {
+      return 0;
+    }
+  }
+
+  return 0;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Add a signature to the nogood store. Returns 0 if it was already
+// there, or the store is too full around its slot.
+
+int game_nogood_add(uint64_t signature) {
+
+  for (size_t i=0; i<NOGOOD_MAX_PROBES; ++i) {
+    size_t slot = (signature + i) & (NOGOOD_STORE_SIZE - 1);
+    uint64_t expected = 0;
+    if (__atomic_compare_exchange_n(g_nogoods + slot, &expected, signature,
+                                    0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      return 1;
+    } else if (expected == signature) {
+      return 0;
+    }
+  }
+
+  return 0;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Next weight for an anytime search to try: halve the amount over 1,
+// until it is close enough to just use 1.
+
+double anytime_next_weight(double weight) {
+  return weight - 1 < 0.1 ? 1 : 1 + 0.5*(weight - 1);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Searches below can call each other recursively.
+
+int game_search_core(const game_info_t* info,
+                     const game_state_t* init_state,
+                     const hint_t* hint,
+                     node_storage_t* storage,
+                     queue_t* q,
+                     search_stats_t* stats,
+                     int anytime,
+                     const tree_node_t** solution_out);
+
+//////////////////////////////////////////////////////////////////////
+// Everything needed to run a search of one independent subproblem,
+// possibly in its own thread.
+
+typedef struct subsearch_struct {
+  const game_info_t* info;
+  const hint_t* hint;
+  game_state_t state;       // Sub-state to solve, replaced by solution
+  node_storage_t storage;   // Slice of the parent's node storage
+  search_stats_t stats;
+  double cost;              // Cost to come of solution
+  int result;
+} subsearch_t;
+
+//////////////////////////////////////////////////////////////////////
+// Run a sub-search. Its nodes are discarded when it is done.
+
+void* game_subsearch_run(void* arg) {
+
+  subsearch_t* sub = arg;
+
+  queue_t q = queue_create(sub->storage.capacity);
+  const tree_node_t* solution_node = NULL;
+
+  memset(&sub->stats, 0, sizeof(sub->stats));
+  
+  sub->result = game_search_core(sub->info, &sub->state, sub->hint,
+                                 &sub->storage, &q, &sub->stats,
+                                 0, &solution_node);
+
+  if (sub->result == SEARCH_SUCCESS) {
+    sub->state = solution_node->state;
+    sub->cost = solution_node->cost_to_come;
+  }
+  
+  sub->stats.subsearch_nodes += sub->storage.count;
+
+  queue_destroy(&q);
+
+  return NULL;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// If the free space of a state splits into independent subproblems,
+// search each of them using the unused part of the node storage (in
+// parallel if threads are available), and combine their solutions.
+// Returns SEARCH_IN_PROGRESS if the state doesn't split, otherwise
+// the result for the state as a whole.
+
+int game_search_split(const game_info_t* info,
+                      const game_state_t* state,
+                      const hint_t* hint,
+                      node_storage_t* storage,
+                      search_stats_t* stats,
+                      game_state_t* solution,
+                      double* cost) {
+
+  game_state_t substates[MAX_COLORS];
+
+  size_t num_groups = game_split_state(info, state, substates);
+
+  if (!num_groups) {
+    return SEARCH_UNREACHABLE;
+  } else if (num_groups == 1) {
+    return SEARCH_IN_PROGRESS;
+  }
+
+  ++stats->splits;
+
+  // Skip the sub-searches if any subproblem already failed somewhere
+  // else in the search.
+  uint64_t signatures[num_groups];
+
+  if (g_options.search_nogoods) {
+    for (size_t g=0; g<num_groups; ++g) {
+      signatures[g] = game_signature(info, substates + g);
+      if (game_nogood_find(signatures[g])) {
+        ++stats->nogoods_pruned;
+        return SEARCH_UNREACHABLE;
+      }
+    }
+  }
+
+  subsearch_t subs[num_groups];
+
+  size_t available = storage->capacity - storage->count;
+
+#ifndef _WIN32
+  int threaded = g_options.search_threads;
+  pthread_t threads[num_groups];
+#else
+  int threaded = 0;
+#endif
+
+  int started[num_groups];
+
+  for (size_t g=0; g<num_groups; ++g) {
+    
+    subsearch_t* sub = subs + g;
+
+    sub->info = info;
+    sub->hint = hint;
+    sub->state = substates[g];
+
+    // Sequential searches can each reuse all of the unused storage,
+    // but threads need their own slices.
+    sub->storage.start = storage->start + storage->count;
+    sub->storage.capacity = available;
+    sub->storage.count = 0;
+
+    if (threaded) {
+      sub->storage.start += g * (available / num_groups);
+      sub->storage.capacity = available / num_groups;
+    }
+
+    started[g] = 0;
+
+#ifndef _WIN32
+    // Last one runs in this thread
+    if (threaded && g+1 < num_groups) {
+      started[g] = !pthread_create(threads + g, NULL,
+                                   game_subsearch_run, sub);
+    }
+#endif
+
+    if (!started[g]) {
+      game_subsearch_run(sub);
+    }
+    
+  }
+
+  int result = SEARCH_SUCCESS;
+
+  *solution = *state;
+  *cost = 0;
+
+  for (size_t g=0; g<num_groups; ++g) {
+
+    const subsearch_t* sub = subs + g;
+
+#ifndef _WIN32
+    if (started[g]) {
+      pthread_join(threads[g], NULL);
+    }
+#endif
+
+    search_stats_add(stats, &sub->stats);
+
+    if (sub->result == SEARCH_UNREACHABLE) {
+      result = SEARCH_UNREACHABLE;
+      if (g_options.search_nogoods && game_nogood_add(signatures[g])) {
+        ++stats->nogoods_stored;
+      }
+    } else if (result == SEARCH_SUCCESS && sub->result != SEARCH_SUCCESS) {
+      result = sub->result;
+    }
+
+    if (result != SEARCH_SUCCESS) {
+      continue;
+    }
+
+    // Copy over the cells of this subproblem's colors (joining the
+    // ends of a path can update existing cells too), and their ends.
+    uint16_t colors = ~substates[g].completed & ((1 << info->num_colors) - 1);
+    
+    for (size_t y=0; y<info->size; ++y) {
+      for (size_t x=0; x<info->size; ++x) {
+        pos_t pos = pos_from_coords(x, y);
+        cell_t cell = sub->state.cells[pos];
+        if (cell && (colors & (1 << cell_get_color(cell)))) {
+          solution->cells[pos] = cell;
+        }
+      }
+    }
+
+    for (size_t color=0; color<info->num_colors; ++color) {
+      if (colors & (1 << color)) {
+        solution->pos[color] = sub->state.pos[color];
+        solution->tail[color] = sub->state.tail[color];
+      }
+    }
+
+    solution->completed |= sub->state.completed;
+    solution->num_free -= substates[g].num_free;
+    *cost += sub->cost;
+    
+  }
+
+  return result;
+  
+}
+
+//////////////////////////////////////////////////////////////////////
+// Run A* or BFS search from the given state using the given node
+// storage and queue, without printing anything. On success,
+// *solution_out is set to the solution node.
+//
+// An anytime search (best-first only) starts with a big weight on
+// cost to go, and each time it finds a solution, lowers the weight
+// and re-sorts the queue instead of starting over, pruning nodes that
+// can't beat the best solution so far. It ends once the weight is 1
+// and it finds a solution, or it runs out of nodes to improve on it.
+
+int game_search_core(const game_info_t* info,
+                     const game_state_t* init_state,
+                     const hint_t* hint,
+                     node_storage_t* storage,
+                     queue_t* q,
+                     search_stats_t* stats,
+                     int anytime,
+                     const tree_node_t** solution_out) {
+
+  int result = SEARCH_IN_PROGRESS;
+  const tree_node_t* solution_node = NULL;
+
+  double start = now();
+  double weight = 1;
+  double bound = HUGE_VAL;
+
+  if (anytime) {
+    weight = g_options.search_weight > 1 ?
+      g_options.search_weight : ANYTIME_WEIGHT;
+    heapq_reweight(q, weight);
+  }
+
+  // With lazy checks, children only get the cheap checks when they
+  // are generated, and the expensive ones once they are dequeued.
+  int child_checks = g_options.node_lazy_checks ? CHECKS_CHEAP : CHECKS_ALL;
+
+  // Partial expansion needs a priority queue to re-queue parents.
+  int partial_expansion = (g_options.search_partial_expansion &&
+                           g_options.search_best_first);
+
+  tree_node_t* root = node_create(storage, NULL, info, init_state);
+
+  if (root) {
+    node_update_costs(info, root, 0);
+    root = game_validate_ff(info, root, storage, CHECKS_ALL, stats);
+    result = root ? SEARCH_IN_PROGRESS : SEARCH_UNREACHABLE;
+    // Forced moves alone can finish a nearly solved state
+    if (root && root->state.num_free == 0 &&
+        root->state.completed == (1 << info->num_colors) - 1) {
+      solution_node = root;
+      result = SEARCH_SUCCESS;
+      root = NULL;
+    }
+  } else {
+    // Sub-searches and restarts can get very little storage
+    result = SEARCH_FULL;
+  }
+
+  if (root) {
+    queue_enqueue(q, root);
+  }
+  
+  while (result == SEARCH_IN_PROGRESS) {
+
+    if (queue_empty(q)) {
+      result = solution_node ? SEARCH_SUCCESS : SEARCH_UNREACHABLE;
+      break;
+    }
+
+    tree_node_t* n = queue_deque(q);
+    assert(n);
+
+    if (n->cost_to_come + n->cost_to_go >= bound) {
+      continue;
+    }
+
+    if (g_options.node_lazy_checks && !n->expansions &&
+        game_check_state(info, &n->state, CHECKS_EXPENSIVE, stats, 0, 0)) {
+      continue;
+    }
+
+    if (g_options.search_split && !n->expansions) {
+
+      game_state_t split_solution;
+      double split_cost;
+
+      int split_result = game_search_split(info, &n->state, hint,
+                                           storage, stats,
+                                           &split_solution, &split_cost);
+
+      if (split_result == SEARCH_UNREACHABLE) {
+        continue;
+      } else if (split_result == SEARCH_SUCCESS) {
+        tree_node_t* split_node = node_create(storage, n, info,
+                                              &split_solution);
+        if (!split_node) {
+          result = SEARCH_FULL;
+          break;
+        }
+        node_update_costs(info, split_node, split_cost);
+        if (split_node->cost_to_come < bound) {
+          solution_node = split_node;
+          bound = split_node->cost_to_come;
+          if (!anytime || weight == 1) {
+            result = SEARCH_SUCCESS;
+            break;
+          }
+          search_stats_round(stats, storage, weight, bound, start);
+          weight = anytime_next_weight(weight);
+          heapq_reweight(q, weight);
+        }
+        continue;
+      } else if (split_result != SEARCH_IN_PROGRESS) {
+        result = split_result;
+        break;
+      }
+      
+    }
+
+    const game_state_t* parent_state = &n->state;
+
+    int color = game_next_move_color(info, parent_state);
+
+    game_state_t swapped;
+
+    if (game_next_move_end(info, parent_state, color)) {
+      swapped = *parent_state;
+      game_swap_ends(&swapped, color);
+      parent_state = &swapped;
+    }
+
+    uint8_t skip_dirs = 0;
+
+    // Hints may favor either of two mirrored moves
+    if (g_options.search_symmetry && info->num_symmetries && !hint) {
+      skip_dirs = game_symmetric_moves(info, parent_state, color);
+    }
+
+    double next_cost = HUGE_VAL;
+      
+    for (int d=0; d<4; ++d) {
+
+      int dir = info->dir_order[d];
+
+      int forced = 0;
+
+      if (g_options.order_forced_first && !g_options.search_fast_forward) {
+        forced = game_find_forced(info, &n->state, &color, &dir, 0);
+      }
+
+      if (!forced && (skip_dirs & (1 << dir))) {
+        ++stats->symmetric_pruned;
+        continue;
+      }
+
+      // Forced moves come from heads of the unswapped state
+      const game_state_t* move_state = forced ? &n->state : parent_state;
+     
+      if (game_can_move(info, move_state,
+                        color, dir)) {
+
+        tree_node_t* child = node_create(storage, n, info,
+                                         move_state);
+
+        if (!child) {
+          result = SEARCH_FULL;
+          break;
+          
+        }
+
+        pos_t next_pos = pos_offset_pos(info, move_state->pos[color], dir);
+
+        double action_cost = game_make_move(info, &child->state,
+                                            color, dir, forced);
+
+        if (hint) {
+          action_cost += hint->penalty[next_pos][color];
+        }
+
+        // Negative if the corridor dead-ended
+        int corridor_cost = 0;
+
+        if (g_options.search_corridors) {
+          // Corridor cells are charged against the hint too
+          corridor_cost = game_follow_corridor(info, &child->state, color,
+                                               hint, &action_cost);
+        }
+
+        if (corridor_cost < 0) {
+          node_storage_unalloc(storage, child);
+          child = 0;
+        } else {
+          
+          node_update_costs(info, child, action_cost + corridor_cost);
+
+          if (partial_expansion &&
+              !node_partial_keep(n, child, q->heapq.weight,
+                                 &next_cost)) {
+            // Not stored on this expansion of the parent
+            node_storage_unalloc(storage, child);
+            child = 0;
+          } else {
+            child = game_validate_ff(info, child, storage,
+                                     child_checks, stats);
+          }
+          
+        }
+        
+        if (child) {
+
+          const game_state_t* child_state = &child->state;
+          
+          if ( child_state->num_free == 0 && 
+               child_state->completed == (1 << info->num_colors) - 1 ) {
+
+            if (child->cost_to_come < bound) {
+
+              solution_node = child;
+              bound = child->cost_to_come;
+
+              if (!anytime || weight == 1) {
+                result = SEARCH_SUCCESS;
+                break;
+              }
+
+              // Keep going with a smaller weight
+              search_stats_round(stats, storage, weight, bound, start);
+              weight = anytime_next_weight(weight);
+              heapq_reweight(q, weight);
+              
+            }
+      
+          } else if (child->cost_to_come + child->cost_to_go < bound) {
+          
+            queue_enqueue(q, child);
+            
+          }
+          
+        }
+
+      } // if can move
+
+      if (forced) { break; }
+
+    } // for each dir
+
+    if (result == SEARCH_IN_PROGRESS && next_cost < HUGE_VAL) {
+      // Re-queue parent with the queue key of its best deferred child
+      n->cost_to_go = (next_cost - n->cost_to_come) / q->heapq.weight;
+      ++n->expansions;
+      ++stats->requeued;
+      queue_enqueue(q, n);
+    }
+
+  } // while search active
+
+  if (anytime) {
+    // Out of room, but still have a solution
+    if (result == SEARCH_FULL && solution_node) {
+      result = SEARCH_SUCCESS;
+    }
+    search_stats_round(stats, storage, weight, bound, start);
+  }
+
+  *solution_out = solution_node;
+  
+  return result;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Luby et al.'s restart sequence 1, 1, 2, 1, 1, 2, 4, 1, 1, 2, ...
+// for i starting at 1.
+
+size_t luby(size_t i) {
+
+  size_t k = 1;
+
+  while (((size_t)1 << k) - 1 < i) {
+    ++k;
+  }
+
+  if (i == ((size_t)1 << k) - 1) {
+    return (size_t)1 << (k-1);
+  } else {
+    return luby(i - ((size_t)1 << (k-1)) + 1);
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Run the search, restarting with a new color and move order each
+// time the number of nodes used reaches the next limit in the Luby
+// sequence, until one search gets all of the storage. Every search
+// reuses the same node storage and queue. Returns the result of the
+// last search; *restart_nodes is set to the nodes used by the
+// others.
+
+int game_search_restarts(const game_info_t* info,
+                         const game_state_t* init_state,
+                         const hint_t* hint,
+                         node_storage_t* storage,
+                         queue_t* q,
+                         search_stats_t* stats,
+                         int anytime,
+                         const tree_node_t** solution_out,
+                         size_t* restart_nodes) {
+
+  game_info_t restart_info = *info;
+  size_t max_nodes = storage->capacity;
+  int result;
+
+  *restart_nodes = 0;
+
+  for (size_t i=1; ; ++i) {
+
+    size_t limit = luby(i);
+
+    if (limit >= max_nodes / g_options.search_restart_unit) {
+      limit = max_nodes;
+    } else {
+      limit *= g_options.search_restart_unit;
+    }
+
+    // The first search gets the usual order
+    unsigned seed = g_options.order_seed + i - 1;
+    
+    if (i > 1) {
+      restart_info.dir_order[0] = 0;
+      restart_info.dir_order[1] = 1;
+      restart_info.dir_order[2] = 2;
+      restart_info.dir_order[3] = 3;
+      memcpy(restart_info.color_order, info->color_order,
+             sizeof(info->color_order));
+      game_shuffle_order(&restart_info, seed);
+    }
+
+    if (!g_options.display_quiet) {
+      printf("search %zu with seed %u can use up to %'zu nodes\n",
+             i, seed, limit);
+    }
+
+    storage->count = 0;
+    storage->capacity = limit;
+    queue_clear(q);
+
+    result = game_search_core(&restart_info, init_state, hint,
+                              storage, q, stats, anytime,
+                              solution_out);
+
+    if (result != SEARCH_FULL || limit == max_nodes) {
+      break;
+    }
+
+    *restart_nodes += storage->count;
+    ++stats->restarts;
+    
+  }
+
+  storage->capacity = max_nodes;
+
+  return result;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Append to a growable array
+
+void sat_vec_push(sat_vec_t* v, int x) {
+
+  if (v->count == v->capacity) {
+    v->capacity = v->capacity ? 2*v->capacity : 16;
+    v->data = realloc(v->data, v->capacity * sizeof(int));
+    if (!v->data) {
+      fprintf(stderr, "out of memory in SAT solver!\n");
+      exit(1);
+    }
+  }
+
+  v->data[v->count++] = x;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Value of a literal: 1 if true, -1 if false, 0 if unset
+
+int sat_lit_value(const sat_solver_t* s, int lit) {
+  int value = s->value[lit >> 1];
+  return (lit & 1) ? -value : value;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Move a variable up the activity heap as far as it should go
+
+void sat_heap_up(sat_solver_t* s, size_t i) {
+
+  int var = s->heap[i];
+
+  while (i > 0) {
+    size_t pi = HEAPQ_PARENT_INDEX(i);
+    if (!(s->activity[var] > s->activity[s->heap[pi]])) { break; }
+    s->heap[i] = s->heap[pi];
+    s->heap_index[s->heap[i]] = i;
+    i = pi;
+  }
+
+  s->heap[i] = var;
+  s->heap_index[var] = i;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Move a variable down the activity heap as far as it should go
+
+void sat_heap_down(sat_solver_t* s, size_t i) {
+
+  int var = s->heap[i];
+
+  while (1) {
+    size_t ci = HEAPQ_LCHILD_INDEX(i);
+    if (ci >= s->heap_count) { break; }
+    if (ci + 1 < s->heap_count &&
+        s->activity[s->heap[ci+1]] > s->activity[s->heap[ci]]) {
+      ++ci;
+    }
+    if (!(s->activity[s->heap[ci]] > s->activity[var])) { break; }
+    s->heap[i] = s->heap[ci];
+    s->heap_index[s->heap[i]] = i;
+    i = ci;
+  }
+
+  s->heap[i] = var;
+  s->heap_index[var] = i;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Put a variable back on the activity heap if it isn't there
+
+void sat_heap_insert(sat_solver_t* s, int var) {
+
+  if (s->heap_index[var] < 0) {
+    s->heap[s->heap_count] = var;
+    sat_heap_up(s, s->heap_count++);
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Create a solver with the given number of variables and no clauses
+
+void sat_create(sat_solver_t* s, size_t num_vars) {
+
+  memset(s, 0, sizeof(sat_solver_t));
+
+  s->num_vars = num_vars;
+  s->watches = calloc(2*num_vars, sizeof(sat_vec_t));
+  s->value = calloc(num_vars, sizeof(int8_t));
+  s->phase = calloc(num_vars, sizeof(int8_t));
+  s->level = calloc(num_vars, sizeof(int));
+  s->reason = calloc(num_vars, sizeof(int));
+  s->activity = calloc(num_vars, sizeof(double));
+  s->heap = calloc(num_vars, sizeof(int));
+  s->heap_index = calloc(num_vars, sizeof(int));
+  s->trail = calloc(num_vars, sizeof(int));
+  s->seen = calloc(num_vars, sizeof(uint8_t));
+
+  if (!s->watches || !s->value || !s->phase || !s->level ||
+      !s->reason || !s->activity || !s->heap || !s->heap_index ||
+      !s->trail || !s->seen) {
+    fprintf(stderr, "out of memory creating SAT solver!\n");
+    exit(1);
+  }
+
+  s->var_inc = 1;
+  s->ok = 1;
+
+  for (size_t var=0; var<num_vars; ++var) {
+    s->heap_index[var] = -1;
+    sat_heap_insert(s, var);
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Free the memory allocated for the solver
+
+void sat_destroy(sat_solver_t* s) {
+
+  for (size_t lit=0; lit<2*s->num_vars; ++lit) {
+    free(s->watches[lit].data);
+  }
+
+  free(s->clauses.data);
+  free(s->watches);
+  free(s->value);
+  free(s->phase);
+  free(s->level);
+  free(s->reason);
+  free(s->activity);
+  free(s->heap);
+  free(s->heap_index);
+  free(s->trail);
+  free(s->seen);
+  free(s->trail_lim.data);
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Set a literal true at the current decision level
+
+void sat_assign(sat_solver_t* s, int lit, int reason) {
+
+  int var = lit >> 1;
+
+  s->value[var] = (lit & 1) ? -1 : 1;
+  s->level[var] = s->trail_lim.count;
+  s->reason[var] = reason;
+  s->trail[s->trail_count++] = lit;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Store a clause of two or more literals, watching the first two.
+// Returns its offset in the clause storage.
+
+int sat_store_clause(sat_solver_t* s, const int* lits, size_t n) {
+
+  int c = s->clauses.count;
+
+  sat_vec_push(&s->clauses, n);
+
+  for (size_t i=0; i<n; ++i) {
+    sat_vec_push(&s->clauses, lits[i]);
+  }
+
+  sat_vec_push(s->watches + lits[0], c);
+  sat_vec_push(s->watches + lits[1], c);
+
+  return c;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Undo assignments above the given decision level
+
+void sat_cancel_until(sat_solver_t* s, size_t level) {
+
+  if (s->trail_lim.count <= level) {
+    return;
+  }
+
+  size_t start = s->trail_lim.data[level];
+
+  for (size_t i=s->trail_count; i-- > start; ) {
+    int var = s->trail[i] >> 1;
+    s->phase[var] = s->value[var];
+    s->value[var] = 0;
+    sat_heap_insert(s, var);
+  }
+
+  s->trail_count = s->qhead = start;
+  s->trail_lim.count = level;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Propagate assignments through the watched literals of each
+// clause. Returns the offset of a conflicting clause, or -1.
+
+int sat_propagate(sat_solver_t* s) {
+
+  while (s->qhead < s->trail_count) {
+
+    int false_lit = s->trail[s->qhead++] ^ 1;
+    sat_vec_t* ws = s->watches + false_lit;
+
+    size_t i = 0, j = 0;
+
+    while (i < ws->count) {
+
+      int c = ws->data[i++];
+      int size = s->clauses.data[c];
+      int* lits = s->clauses.data + c + 1;
+
+      // Keep the false literal second
+      if (lits[0] == false_lit) {
+        lits[0] = lits[1];
+        lits[1] = false_lit;
+      }
+
+      if (sat_lit_value(s, lits[0]) > 0) {
+        ws->data[j++] = c;
+        continue;
+      }
+
+      // Look for another literal to watch
+      int k;
+
+      for (k=2; k<size; ++k) {
+        if (sat_lit_value(s, lits[k]) >= 0) {
+          lits[1] = lits[k];
+          lits[k] = false_lit;
+          sat_vec_push(s->watches + lits[1], c);
+          break;
+        }
+      }
+
+      if (k < size) { continue; }
+
+      ws->data[j++] = c;
+
+      if (sat_lit_value(s, lits[0]) < 0) {
+        while (i < ws->count) {
+          ws->data[j++] = ws->data[i++];
+        }
+        ws->count = j;
+        s->qhead = s->trail_count;
+        return c;
+      }
+
+      sat_assign(s, lits[0], c);
+
+    }
+
+    ws->count = j;
+
+  }
+
+  return -1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Add a clause before (or in between) solving. Returns 0 if the
+// clauses are now known to be unsatisfiable.
+
+int sat_add_clause(sat_solver_t* s, const int* lits, size_t n) {
+
+  sat_cancel_until(s, 0);
+
+  if (!s->ok) { return 0; }
+
+  int keep[n+1];
+  size_t m = 0;
+
+  for (size_t i=0; i<n; ++i) {
+
+    int value = sat_lit_value(s, lits[i]);
+
+    if (value > 0) {
+      return 1; // already satisfied
+    } else if (value < 0) {
+      continue;
+    }
+
+    size_t j;
+
+    for (j=0; j<m; ++j) {
+      if (keep[j] == lits[i]) {
+        break;
+      } else if (keep[j] == (lits[i] ^ 1)) {
+        return 1; // always satisfied
+      }
+    }
+
+    if (j == m) {
+      keep[m++] = lits[i];
+    }
+
+  }
+
+  if (m == 0) {
+    s->ok = 0;
+  } else if (m == 1) {
+    sat_assign(s, keep[0], -1);
+    if (sat_propagate(s) >= 0) {
+      s->ok = 0;
+    }
+  } else {
+    sat_store_clause(s, keep, m);
+  }
+
+  return s->ok;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Bump the activity of a variable involved in a conflict
+
+void sat_bump(sat_solver_t* s, int var) {
+
+  s->activity[var] += s->var_inc;
+
+  if (s->activity[var] > 1e100) {
+    for (size_t v=0; v<s->num_vars; ++v) {
+      s->activity[v] *= 1e-100;
+    }
+    s->var_inc *= 1e-100;
+  }
+
+  if (s->heap_index[var] >= 0) {
+    sat_heap_up(s, s->heap_index[var]);
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Find the first unique implication point of a conflict and learn a
+// clause that asserts its negation. The asserting literal is put
+// first, and the one from the highest remaining level second.
+// Returns the level to backjump to.
+
+size_t sat_analyze(sat_solver_t* s, int confl, sat_vec_t* learnt) {
+
+  int cur_level = s->trail_lim.count;
+  size_t index = s->trail_count;
+  int path_count = 0;
+  int lit = -1;
+
+  learnt->count = 0;
+  sat_vec_push(learnt, -1);
+
+  do {
+
+    int size = s->clauses.data[confl];
+    const int* lits = s->clauses.data + confl + 1;
+
+    // The first literal of a reason clause is the one it implied
+    for (int k=(lit < 0 ? 0 : 1); k<size; ++k) {
+      int var = lits[k] >> 1;
+      if (!s->seen[var] && s->level[var] > 0) {
+        sat_bump(s, var);
+        s->seen[var] = 1;
+        if (s->level[var] >= cur_level) {
+          ++path_count;
+        } else {
+          sat_vec_push(learnt, lits[k]);
+        }
+      }
+    }
+
+    while (!s->seen[s->trail[--index] >> 1]) { }
+
+    lit = s->trail[index];
+    confl = s->reason[lit >> 1];
+    s->seen[lit >> 1] = 0;
+    --path_count;
+
+  } while (path_count > 0);
+
+  learnt->data[0] = lit ^ 1;
+
+  size_t backjump = 0;
+
+  if (learnt->count > 1) {
+    size_t max_i = 1;
+    for (size_t i=2; i<learnt->count; ++i) {
+      if (s->level[learnt->data[i] >> 1] > s->level[learnt->data[max_i] >> 1]) {
+        max_i = i;
+      }
+    }
+    int tmp = learnt->data[1];
+    learnt->data[1] = learnt->data[max_i];
+    learnt->data[max_i] = tmp;
+    backjump = s->level[learnt->data[1] >> 1];
+  }
+
+  for (size_t i=1; i<learnt->count; ++i) {
+    s->seen[learnt->data[i] >> 1] = 0;
+  }
+
+  return backjump;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Solve the clauses added so far, keeping learned clauses (and the
+// activities) for later calls. Restarts follow the Luby sequence.
+// Returns SEARCH_SUCCESS with the model in s->value,
+// SEARCH_UNREACHABLE, or SEARCH_FULL if max_conflicts (if nonzero)
+// ran out.
+
+int sat_solve(sat_solver_t* s, size_t max_conflicts) {
+
+  if (!s->ok) { return SEARCH_UNREACHABLE; }
+
+  sat_vec_t learnt = { 0, 0, 0 };
+
+  size_t restarts = 1;
+  size_t restart_conflicts = 0;
+  int result = SEARCH_IN_PROGRESS;
+
+  while (result == SEARCH_IN_PROGRESS) {
+
+    int confl = sat_propagate(s);
+
+    if (confl >= 0) {
+
+      ++s->conflicts;
+      ++restart_conflicts;
+
+      if (!s->trail_lim.count) {
+        s->ok = 0;
+        result = SEARCH_UNREACHABLE;
+        break;
+      }
+
+      size_t backjump = sat_analyze(s, confl, &learnt);
+      sat_cancel_until(s, backjump);
+
+      if (learnt.count == 1) {
+        sat_assign(s, learnt.data[0], -1);
+      } else {
+        int c = sat_store_clause(s, learnt.data, learnt.count);
+        sat_assign(s, learnt.data[0], c);
+      }
+
+      s->var_inc /= SAT_ACTIVITY_DECAY;
+
+      if (max_conflicts && s->conflicts >= max_conflicts) {
+        result = SEARCH_FULL;
+      }
+
+    } else if (restart_conflicts >= luby(restarts) * SAT_RESTART_CONFLICTS) {
+
+      ++restarts;
+      restart_conflicts = 0;
+      sat_cancel_until(s, 0);
+
+    } else {
+
+      int var = -1;
+
+      while (s->heap_count) {
+        int top = s->heap[0];
+        s->heap_index[top] = -1;
+        if (--s->heap_count) {
+          s->heap[0] = s->heap[s->heap_count];
+          sat_heap_down(s, 0);
+        }
+        if (!s->value[top]) {
+          var = top;
+          break;
+        }
+      }
+
+      if (var < 0) {
+        result = SEARCH_SUCCESS;
+      } else {
+        ++s->decisions;
+        sat_vec_push(&s->trail_lim, s->trail_count);
+        sat_assign(s, 2*var + (s->phase[var] > 0 ? 0 : 1), -1);
+      }
+
+    }
+
+  }
+
+  free(learnt.data);
+
+  return result;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Add clauses saying at most one of the literals is true
+
+void sat_at_most_one(sat_solver_t* s, const int* lits, size_t n) {
+
+  for (size_t i=0; i<n; ++i) {
+    for (size_t j=i+1; j<n; ++j) {
+      int clause[2] = { lits[i] ^ 1, lits[j] ^ 1 };
+      sat_add_clause(s, clause, 2);
+    }
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// SAT variable saying a cell has a color: one per color for each
+// cell of the board.
+
+int game_sat_color_var(const game_info_t* info, pos_t pos, int color) {
+  int x, y;
+  pos_get_coords(pos, &x, &y);
+  return (y*info->size + x)*info->num_colors + color;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Encode the puzzle as SAT the way pyflowsolver.py does: each cell
+// has exactly one color, endpoints have exactly one neighbor of their
+// color, and each free cell has exactly one direction type (pair of
+// neighbors it connects), which forces those neighbors to share its
+// color and the others not to. Sets dir_vars[pos][t] to the variable
+// for direction type t of the free cell at pos, or -1.
+
+void game_sat_encode(const game_info_t* info,
+                     const game_state_t* state,
+                     sat_solver_t* s,
+                     int dir_vars[MAX_CELLS][SAT_NUM_DIR_TYPES]) {
+
+  size_t num_vars = info->size * info->size * info->num_colors;
+
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+      pos_t pos = pos_from_coords(x, y);
+      int valid = 0;
+      for (int dir=0; dir<4; ++dir) {
+        if (pos_offset_pos(info, pos, dir) != INVALID_POS) {
+          valid |= (1 << dir);
+        }
+      }
+      for (int t=0; t<SAT_NUM_DIR_TYPES; ++t) {
+        dir_vars[pos][t] = -1;
+        if (!state->cells[pos] &&
+            (SAT_DIR_TYPES[t] & valid) == SAT_DIR_TYPES[t]) {
+          dir_vars[pos][t] = num_vars++;
+        }
+      }
+    }
+  }
+
+  sat_create(s, num_vars);
+
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+
+      pos_t pos = pos_from_coords(x, y);
+      cell_t cell = state->cells[pos];
+
+      int lits[MAX_COLORS];
+      size_t n = 0;
+
+      if (cell) {
+
+        // Endpoint has its own color and no other
+        int color = cell_get_color(cell);
+
+        for (size_t other=0; other<info->num_colors; ++other) {
+          int lit = 2*game_sat_color_var(info, pos, other);
+          if ((int)other != color) { lit ^= 1; }
+          sat_add_clause(s, &lit, 1);
+        }
+
+        // Exactly one neighbor has the same color
+        for (int dir=0; dir<4; ++dir) {
+          pos_t neighbor_pos = pos_offset_pos(info, pos, dir);
+          if (neighbor_pos != INVALID_POS) {
+            lits[n++] = 2*game_sat_color_var(info, neighbor_pos, color);
+          }
+        }
+
+        sat_add_clause(s, lits, n);
+        sat_at_most_one(s, lits, n);
+
+        continue;
+
+      }
+
+      // Exactly one color
+      for (size_t color=0; color<info->num_colors; ++color) {
+        lits[n++] = 2*game_sat_color_var(info, pos, color);
+      }
+
+      sat_add_clause(s, lits, n);
+      sat_at_most_one(s, lits, n);
+
+      // Exactly one direction type
+      n = 0;
+
+      for (int t=0; t<SAT_NUM_DIR_TYPES; ++t) {
+        if (dir_vars[pos][t] >= 0) {
+          lits[n++] = 2*dir_vars[pos][t];
+        }
+      }
+
+      sat_add_clause(s, lits, n);
+      sat_at_most_one(s, lits, n);
+
+      // Direction types decide which neighbors share the color
+      for (int t=0; t<SAT_NUM_DIR_TYPES; ++t) {
+
+        if (dir_vars[pos][t] < 0) { continue; }
+
+        int not_dir = 2*dir_vars[pos][t] + 1;
+
+        for (int dir=0; dir<4; ++dir) {
+
+          pos_t neighbor_pos = pos_offset_pos(info, pos, dir);
+          if (neighbor_pos == INVALID_POS) { continue; }
+
+          for (size_t color=0; color<info->num_colors; ++color) {
+
+            int c1 = 2*game_sat_color_var(info, pos, color);
+            int c2 = 2*game_sat_color_var(info, neighbor_pos, color);
+
+            if (SAT_DIR_TYPES[t] & (1 << dir)) {
+              int same1[3] = { not_dir, c1 ^ 1, c2 };
+              int same2[3] = { not_dir, c1, c2 ^ 1 };
+              sat_add_clause(s, same1, 3);
+              sat_add_clause(s, same2, 3);
+            } else {
+              int differ[3] = { not_dir, c1 ^ 1, c2 ^ 1 };
+              sat_add_clause(s, differ, 3);
+            }
+
+          }
+
+        }
+
+      }
+
+    }
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Follow the path of the model through a free cell at pos: returns
+// the direction to leave it by, given the direction it was entered
+// by (or -1 to take either).
+
+int game_sat_next_dir(const sat_solver_t* s,
+                      int dir_vars[MAX_CELLS][SAT_NUM_DIR_TYPES],
+                      pos_t pos, int in_dir) {
+
+  for (int t=0; t<SAT_NUM_DIR_TYPES; ++t) {
+    if (dir_vars[pos][t] >= 0 && s->value[dir_vars[pos][t]] > 0) {
+      for (int dir=0; dir<4; ++dir) {
+        if ((SAT_DIR_TYPES[t] & (1 << dir)) &&
+            (in_dir < 0 || dir != (in_dir ^ 1))) {
+          return dir;
+        }
+      }
+    }
+  }
+
+  assert(0 && "free cell has no direction type");
+  return -1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read the paths out of a model of the SAT encoding into the final
+// state. Any cells left over form cycles, and get a clause added to
+// rule out each one. Returns the number of cycles found.
+
+size_t game_sat_decode(const game_info_t* info,
+                       sat_solver_t* s,
+                       int dir_vars[MAX_CELLS][SAT_NUM_DIR_TYPES],
+                       game_state_t* state) {
+
+  uint8_t visited[MAX_CELLS];
+  memset(visited, 0, sizeof(visited));
+
+  for (size_t color=0; color<info->num_colors; ++color) {
+
+    pos_t pos = info->init_pos[color];
+    visited[pos] = 1;
+
+    // Endpoints go towards their one neighbor of the same color
+    int dir;
+
+    for (dir=0; dir<4; ++dir) {
+      pos_t neighbor_pos = pos_offset_pos(info, pos, dir);
+      if (neighbor_pos != INVALID_POS &&
+          s->value[game_sat_color_var(info, neighbor_pos, color)] > 0) {
+        break;
+      }
+    }
+
+    while (1) {
+
+      state->pos[color] = pos;
+      pos = pos_offset_pos(info, pos, dir);
+      visited[pos] = 1;
+
+      if (pos == info->goal_pos[color]) {
+        state->cells[pos] = cell_create(TYPE_GOAL, color, dir);
+        break;
+      }
+
+      state->cells[pos] = cell_create(TYPE_PATH, color, dir);
+      --state->num_free;
+      dir = game_sat_next_dir(s, dir_vars, pos, dir);
+
+    }
+
+    state->tail[color] = info->goal_pos[color];
+    state->completed |= (1 << color);
+
+  }
+
+  // Adding a clause backtracks the solver, which wipes out the model,
+  // so read every cycle first and only rule them out afterwards
+  int lits[MAX_CELLS*SAT_NUM_DIR_TYPES];
+  size_t ends[MAX_CELLS];
+  size_t n = 0, cycles = 0;
+
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+
+      pos_t start = pos_from_coords(x, y);
+      if (visited[start]) { continue; }
+
+      // Rule out this exact combination of direction types
+      pos_t pos = start;
+      int dir = -1;
+
+      do {
+        visited[pos] = 1;
+        for (int t=0; t<SAT_NUM_DIR_TYPES; ++t) {
+          if (dir_vars[pos][t] >= 0 && s->value[dir_vars[pos][t]] > 0) {
+            lits[n++] = 2*dir_vars[pos][t] + 1;
+          }
+        }
+        dir = game_sat_next_dir(s, dir_vars, pos, dir);
+        pos = pos_offset_pos(info, pos, dir);
+      } while (pos != start);
+
+      ends[cycles++] = n;
+
+    }
+  }
+
+  for (size_t i=0; i<cycles; ++i) {
+    size_t begin = i ? ends[i-1] : 0;
+    sat_add_clause(s, lits + begin, ends[i] - begin);
+  }
+
+  return cycles;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Solve the puzzle by reducing it to SAT instead of searching. When
+// a model has cycles, clauses ruling them out are added and the same
+// solver carries on with everything it has learned so far.
+
+int game_search_sat(const game_info_t* info,
+                    const game_state_t* init_state,
+                    double* elapsed_out,
+                    size_t* nodes_out,
+                    search_stats_t* stats_out,
+                    game_state_t* final_state) {
+
+  double start = now();
+
+  sat_solver_t s;
+  int dir_vars[MAX_CELLS][SAT_NUM_DIR_TYPES];
+
+  game_sat_encode(info, init_state, &s, dir_vars);
+
+  if (!g_options.display_quiet) {
+    printf("reduced to SAT with %'zu variables and %'zu clause literals "
+           "in %'.3f seconds\n\n",
+           s.num_vars, s.clauses.count, now() - start);
+    game_print(info, init_state);
+  }
+
+  game_state_t state = *init_state;
+  size_t repairs = 0;
+  int result;
+
+  while (1) {
+
+    result = sat_solve(&s, g_options.search_max_nodes);
+    if (result != SEARCH_SUCCESS) { break; }
+
+    state = *init_state;
+
+    if (!game_sat_decode(info, &s, dir_vars, &state)) { break; }
+
+    ++repairs;
+
+  }
+
+  double elapsed = now() - start;
+
+  if (elapsed_out) { *elapsed_out = elapsed; }
+  if (nodes_out)   { *nodes_out = s.decisions; }
+  if (stats_out)   { memset(stats_out, 0, sizeof(search_stats_t)); }
+
+  if (final_state) { *final_state = state; }
+
+  if (!g_options.display_quiet) {
+
+    if (result == SEARCH_SUCCESS) {
+      printf("\n");
+      game_print(info, &state);
+    }
+
+    printf("\nsearch %s after %'.3f seconds with %'zu decisions, "
+           "%'zu conflicts and %'zu cycle repairs\n",
+           SEARCH_RESULT_STRINGS[result], elapsed,
+           s.decisions, s.conflicts, repairs);
+
+  }
+
+  sat_destroy(&s);
+
+  return result;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Make room for one more path in the path set
+
+void path_set_grow(path_set_t* paths, size_t num_cells) {
+
+  if (paths->count == paths->capacity) {
+    paths->capacity = paths->capacity ? 2*paths->capacity : 256;
+    paths->start = realloc(paths->start,
+                           (paths->capacity+1) * sizeof(size_t));
+    paths->color = realloc(paths->color, paths->capacity);
+    if (!paths->start || !paths->color) {
+      fprintf(stderr, "out of memory enumerating paths!\n");
+      exit(1);
+    }
+    if (!paths->count) { paths->start[0] = 0; }
+  }
+
+  size_t needed = paths->start[paths->count] + num_cells;
+
+  if (needed > paths->cells_capacity) {
+    while (needed > paths->cells_capacity) {
+      paths->cells_capacity = (paths->cells_capacity ?
+                               2*paths->cells_capacity : 4096);
+    }
+    paths->cells = realloc(paths->cells, paths->cells_capacity);
+    if (!paths->cells) {
+      fprintf(stderr, "out of memory enumerating paths!\n");
+      exit(1);
+    }
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Free the memory allocated for a path set
+
+void path_set_destroy(path_set_t* paths) {
+  free(paths->start);
+  free(paths->color);
+  free(paths->cells);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Record the cells of a complete path in the path set. Returns 0 if
+// there are already too many.
+
+int path_set_add(path_set_t* paths, int color,
+                 const pos_t* trail, size_t length) {
+
+  if (paths->count == paths->max_paths) { return 0; }
+
+  path_set_grow(paths, length);
+  memcpy(paths->cells + paths->start[paths->count], trail, length);
+  paths->color[paths->count] = color;
+  ++paths->count;
+  paths->start[paths->count] = paths->start[paths->count-1] + length;
+
+  return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// The one whole-board check path enumeration runs on each partial
+// path, since the others cost more there than they save. Returns
+// nonzero if some color can no longer reach its goal, or the
+// shortest paths no longer fit.
+
+int game_check_reach(const game_info_t* info,
+                     const game_state_t* state,
+                     search_stats_t* stats) {
+
+  if (!g_options.node_check_distance) { return 0; }
+
+  double start = now();
+
+  uint8_t rmap[MAX_CELLS];
+  size_t rcount = game_build_regions(info, state, rmap);
+
+  return search_stats_record(stats, CHECK_DISTANCE, start,
+                             game_check_distances(info, state, rcount, rmap));
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Depth-first enumeration of the free cells a color's path could
+// take from its head to its goal, following the same rules as
+// game_can_move and game_make_move: no touching itself, and ending
+// as soon as it is next to the goal. The path so far is played out
+// in state, so dead ends and colors cut off from their goals prune
+// it early. Returns 0 once there are too many paths, or it has taken
+// too many steps looking for them.
+
+int game_enum_paths(const game_info_t* info,
+                    game_state_t* state,
+                    int color,
+                    pos_t* trail, size_t length,
+                    path_set_t* paths,
+                    search_stats_t* stats) {
+
+  if (++paths->steps > paths->max_steps) { return 0; }
+
+  pos_t pos = state->pos[color];
+  pos_t goal = info->goal_pos[color];
+
+  for (int dir=0; dir<4; ++dir) {
+
+    if (!game_can_move(info, state, color, dir)) { continue; }
+
+    pos_t next = pos_offset_pos(info, pos, dir);
+
+    if (next == goal) {
+      // Only without the touch rule; with it, paths end next to goal
+      if (!path_set_add(paths, color, trail, length)) { return 0; }
+      continue;
+    }
+
+    game_state_t child = *state;
+    trail[length] = next;
+
+    game_make_move(info, &child, color, dir, 0);
+
+    if (game_check_state(info, &child, CHECKS_CHEAP, stats, 0, 0) ||
+        game_check_reach(info, &child, stats)) {
+      continue;
+    }
+
+    int ok;
+
+    if (child.completed & (1 << color)) {
+      ok = path_set_add(paths, color, trail, length+1);
+    } else {
+      ok = game_enum_paths(info, &child, color, trail, length+1,
+                           paths, stats);
+    }
+
+    if (!ok) { return 0; }
+
+  }
+
+  return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Build the exact cover matrix for a set of paths: one column for
+// each color, one for each free cell, and one row for each path
+// covering its color and cells. Column 0 is the list head.
+
+void dlx_create(dlx_t* d, const game_info_t* info,
+                const game_state_t* state,
+                const path_set_t* paths) {
+
+  memset(d, 0, sizeof(dlx_t));
+
+  size_t num_columns = info->num_colors;
+
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+      pos_t pos = pos_from_coords(x, y);
+      if (!state->cells[pos]) {
+        d->cell_column[pos] = ++num_columns;
+      }
+    }
+  }
+
+  size_t num_nodes = 1 + num_columns + paths->count + paths->start[paths->count];
+
+  d->left = malloc(num_nodes * sizeof(int));
+  d->right = malloc(num_nodes * sizeof(int));
+  d->up = malloc(num_nodes * sizeof(int));
+  d->down = malloc(num_nodes * sizeof(int));
+  d->column = malloc(num_nodes * sizeof(int));
+  d->row = malloc(num_nodes * sizeof(int));
+  d->size = calloc(num_columns + 1, sizeof(int));
+  d->chosen = malloc((num_columns + 1) * sizeof(int));
+
+  if (!d->left || !d->right || !d->up || !d->down ||
+      !d->column || !d->row || !d->size || !d->chosen) {
+    fprintf(stderr, "out of memory creating exact cover matrix!\n");
+    exit(1);
+  }
+
+  for (size_t c=0; c<=num_columns; ++c) {
+    d->left[c] = c ? c-1 : num_columns;
+    d->right[c] = c < num_columns ? c+1 : 0;
+    d->up[c] = d->down[c] = d->column[c] = c;
+    d->row[c] = -1;
+  }
+
+  size_t n = num_columns + 1;
+
+  for (size_t r=0; r<paths->count; ++r) {
+
+    size_t first = n;
+    size_t length = paths->start[r+1] - paths->start[r];
+
+    for (size_t i=0; i<=length; ++i) {
+
+      // Color column first, then the cells
+      int c = i ? d->cell_column[paths->cells[paths->start[r] + i-1]] :
+        paths->color[r] + 1;
+
+      d->column[n] = c;
+      d->row[n] = r;
+      d->up[n] = d->up[c];
+      d->down[n] = c;
+      d->down[d->up[c]] = n;
+      d->up[c] = n;
+      ++d->size[c];
+
+      d->left[n] = i ? n-1 : first + length;
+      d->right[n] = i < length ? n+1 : first;
+
+      ++n;
+
+    }
+
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Free the memory allocated for the matrix
+
+void dlx_destroy(dlx_t* d) {
+  free(d->left);
+  free(d->right);
+  free(d->up);
+  free(d->down);
+  free(d->column);
+  free(d->row);
+  free(d->size);
+  free(d->chosen);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Remove a column and every row that uses it
+
+void dlx_cover(dlx_t* d, int c) {
+
+  d->right[d->left[c]] = d->right[c];
+  d->left[d->right[c]] = d->left[c];
+
+  for (int i=d->down[c]; i!=c; i=d->down[i]) {
+    for (int j=d->right[i]; j!=i; j=d->right[j]) {
+      d->down[d->up[j]] = d->down[j];
+      d->up[d->down[j]] = d->up[j];
+      --d->size[d->column[j]];
+    }
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Undo dlx_cover, in the opposite order
+
+void dlx_uncover(dlx_t* d, int c) {
+
+  for (int i=d->up[c]; i!=c; i=d->up[i]) {
+    for (int j=d->left[i]; j!=i; j=d->left[j]) {
+      ++d->size[d->column[j]];
+      d->down[d->up[j]] = j;
+      d->up[d->down[j]] = j;
+    }
+  }
+
+  d->right[d->left[c]] = c;
+  d->left[d->right[c]] = c;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Knuth's Algorithm X, always branching on the column with the
+// fewest rows. Returns 1 when every column is covered, with the rows
+// used in d->chosen.
+
+int dlx_search(dlx_t* d, size_t depth) {
+
+  if (d->right[0] == 0) {
+    d->num_chosen = depth;
+    return 1;
+  }
+
+  int best = d->right[0];
+
+  for (int c=d->right[best]; c!=0; c=d->right[c]) {
+    if (d->size[c] < d->size[best]) { best = c; }
+  }
+
+  if (!d->size[best]) { return 0; }
+
+  dlx_cover(d, best);
+
+  int found = 0;
+
+  for (int r=d->down[best]; r!=best && !found; r=d->down[r]) {
+
+    ++d->rows_tried;
+    d->chosen[depth] = d->row[r];
+
+    for (int j=d->right[r]; j!=r; j=d->right[j]) {
+      dlx_cover(d, d->column[j]);
+    }
+
+    found = dlx_search(d, depth+1);
+
+    for (int j=d->left[r]; j!=r; j=d->left[j]) {
+      dlx_uncover(d, d->column[j]);
+    }
+
+  }
+
+  dlx_uncover(d, best);
+
+  return found;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Solve the puzzle as an exact cover of its free cells by one
+// enumerated path per color. Returns SEARCH_FULL if the colors have
+// more than g_options.search_max_paths paths between them, so the
+// caller can fall back on searching instead.
+
+int game_search_dlx(const game_info_t* info,
+                    const game_state_t* init_state,
+                    double* elapsed_out,
+                    size_t* nodes_out,
+                    search_stats_t* stats_out,
+                    game_state_t* final_state) {
+
+  double start = now();
+
+  path_set_t paths;
+  memset(&paths, 0, sizeof(paths));
+
+  paths.max_paths = g_options.search_max_paths;
+  paths.max_steps = DLX_STEPS_PER_CELL * init_state->num_free;
+
+  search_stats_t stats;
+  memset(&stats, 0, sizeof(stats));
+
+  game_state_t state = *init_state;
+  pos_t trail[MAX_CELLS];
+  int result = SEARCH_IN_PROGRESS;
+
+  if (game_check_state(info, &state, CHECKS_ALL, &stats, 0, 0)) {
+    result = SEARCH_UNREACHABLE;
+  }
+
+  for (size_t color=0; color<info->num_colors; ++color) {
+
+    if (result != SEARCH_IN_PROGRESS) { break; }
+    
+    size_t count = paths.count;
+    game_state_t color_state = state;
+
+    color_state.last_color = color;
+
+    if (color_state.completed & (1 << color)) {
+      // Endpoints already next to each other
+      path_set_add(&paths, color, trail, 0);
+    } else if (!game_enum_paths(info, &color_state, color, trail, 0,
+                                &paths, &stats)) {
+      result = SEARCH_FULL;
+    } else if (paths.count == count) {
+      result = SEARCH_UNREACHABLE;
+    }
+    
+  }
+
+  if (!g_options.display_quiet) {
+    printf("enumerated %'zu paths in %'zu steps and %'.3f seconds%s\n",
+           paths.count, paths.steps, now() - start,
+           result == SEARCH_FULL ? ", giving up on exact cover" : "");
+  }
+
+  size_t rows_tried = 0;
+
+  if (result == SEARCH_IN_PROGRESS) {
+
+    dlx_t d;
+    dlx_create(&d, info, init_state, &paths);
+
+    result = dlx_search(&d, 0) ? SEARCH_SUCCESS : SEARCH_UNREACHABLE;
+    rows_tried = d.rows_tried;
+
+    if (result == SEARCH_SUCCESS) {
+
+      for (size_t i=0; i<d.num_chosen; ++i) {
+
+        size_t r = d.chosen[i];
+        int color = paths.color[r];
+        pos_t pos = info->init_pos[color];
+
+        for (size_t k=paths.start[r]; k<=paths.start[r+1]; ++k) {
+
+          pos_t next = (k < paths.start[r+1] ?
+                        paths.cells[k] : info->goal_pos[color]);
+
+          int dir;
+          for (dir=0; dir<4; ++dir) {
+            if (pos_offset_pos(info, pos, dir) == next) { break; }
+          }
+
+          if (next == info->goal_pos[color]) {
+            state.cells[next] = cell_create(TYPE_GOAL, color, dir);
+            state.pos[color] = pos;
+          } else {
+            state.cells[next] = cell_create(TYPE_PATH, color, dir);
+            --state.num_free;
+          }
+
+          pos = next;
+
+        }
+
+        state.completed |= (1 << color);
+
+      }
+
+    }
+
+    dlx_destroy(&d);
+
+  }
+
+  path_set_destroy(&paths);
+
+  double elapsed = now() - start;
+
+  if (elapsed_out) { *elapsed_out = elapsed; }
+  if (nodes_out)   { *nodes_out = rows_tried; }
+  if (stats_out)   { memset(stats_out, 0, sizeof(search_stats_t)); }
+
+  if (result == SEARCH_FULL) {
+    return result;
+  }
+
+  if (final_state) { *final_state = state; }
+
+  if (!g_options.display_quiet) {
+
+    if (result == SEARCH_SUCCESS) {
+      printf("\n");
+      game_print(info, &state);
+    }
+
+    printf("\nsearch %s after %'.3f seconds with %'zu rows tried\n",
+           SEARCH_RESULT_STRINGS[result], elapsed, rows_tried);
+
+  }
+
+  return result;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Fill in a solution from the connections of each cell, given as
+// color << 4 | direction flags of the neighbors it connects to, by
+// following each color out from its initial position. Returns 0 if
+// the connections don't make a path from init to goal for every
+// color.
+
+int game_state_from_links(const game_info_t* info,
+                          const game_state_t* init_state,
+                          const uint8_t links[MAX_CELLS],
+                          game_state_t* state) {
+
+  *state = *init_state;
+
+  for (size_t color=0; color<info->num_colors; ++color) {
+
+    pos_t pos = info->init_pos[color];
+    int dir = -1;
+
+    while (pos != info->goal_pos[color]) {
+
+      int from = dir;
+
+      for (dir=0; dir<4; ++dir) {
+        if ((links[pos] & (1 << dir)) &&
+            (from < 0 || dir != (from ^ 1))) {
+          break;
+        }
+      }
+
+      if (dir == 4) { return 0; }
+
+      state->pos[color] = pos;
+      pos = pos_offset_pos(info, pos, dir);
+
+      if (pos == INVALID_POS || (links[pos] >> 4) != color) {
+        return 0;
+      } else if (pos == info->goal_pos[color]) {
+        state->cells[pos] = cell_create(TYPE_GOAL, color, dir);
+      } else if (state->cells[pos]) {
+        return 0;
+      } else {
+        state->cells[pos] = cell_create(TYPE_PATH, color, dir);
+        --state->num_free;
+      }
+
+    }
+
+    state->completed |= (1 << color);
+
+  }
+
+  return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// The opposite of game_state_from_links: get the connections of each
+// cell in a solution.
+
+void game_state_links(const game_info_t* info,
+                      const game_state_t* state,
+                      uint8_t links[MAX_CELLS]) {
+
+  memset(links, 0, MAX_CELLS);
+
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+
+      pos_t pos = pos_from_coords(x, y);
+      cell_t cell = state->cells[pos];
+
+      if (!cell) { continue; }
+
+      links[pos] |= cell_get_color(cell) << 4;
+
+      // Path and goal cells point back to where they came from
+      if (cell_get_type(cell) != TYPE_INIT) {
+        int dir = cell_get_direction(cell);
+        pos_t prev = pos_offset_pos(info, pos, dir ^ 1);
+        links[pos] |= (1 << (dir ^ 1));
+        links[prev] |= (1 << dir);
+      }
+
+    }
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Give the segments in a frontier the lowest ids possible, in order
+// of appearance, so that equivalent frontiers compare equal. Also
+// drops attached flags for segments that are gone.
+
+void frontier_normalize(frontier_t* f, size_t size) {
+
+  uint8_t remap[FRONTIER_MAX_IDS];
+  memset(remap, 0, sizeof(remap));
+
+  uint8_t next_id = 1;
+  uint32_t attached = 0;
+
+  for (size_t x=0; x<=size; ++x) {
+
+    uint8_t* id = x < size ? f->id + x : &f->right_id;
+
+    if (*id) {
+      if (!remap[*id]) {
+        remap[*id] = next_id++;
+        if (f->attached & (1u << *id)) {
+          attached |= (1u << remap[*id]);
+        }
+      }
+      *id = remap[*id];
+    }
+
+  }
+
+  f->attached = attached;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Replace one segment id by another in a frontier
+
+void frontier_relabel(frontier_t* f, size_t size,
+                      uint8_t from, uint8_t to) {
+
+  for (size_t x=0; x<size; ++x) {
+    if (f->id[x] == from) { f->id[x] = to; }
+  }
+
+  if (f->right_id == from) { f->right_id = to; }
+
+  if (f->attached & (1u << from)) {
+    f->attached |= (1u << to);
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Does the frontier have a loose end of the given color? The cell
+// just processed at column x owns the right-going end.
+
+int frontier_has_color(const frontier_t* f, size_t size,
+                       size_t x, int color) {
+
+  for (size_t k=0; k<size; ++k) {
+    if (f->id[k] && f->color[k] == color) { return 1; }
+  }
+
+  return f->right_id && f->color[x] == color;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Can the loose ends of a frontier still be joined up? An end with
+// no partner needs an endpoint of its color still to come (pending).
+// And if two colors each come down to a pair of ends from their
+// endpoints, the pairs may not interleave along the boundary of the
+// undecided cells, since the paths joining them would have to cross.
+
+int frontier_viable(const frontier_t* f, size_t size, size_t x,
+                    uint16_t pending) {
+
+  uint8_t colors[MAX_SIZE+1];
+  int ends[MAX_COLORS];
+  int attached_ends[MAX_COLORS];
+  size_t n = 0;
+
+  memset(ends, 0, sizeof(ends));
+  memset(attached_ends, 0, sizeof(attached_ends));
+
+  // Down ends of row y, then the right end, then down ends of row y-1
+  for (size_t k=0; k<=size; ++k) {
+
+    size_t col = k <= x ? k : k-1;
+    uint8_t id = k == x+1 ? f->right_id : f->id[col];
+
+    if (k == x+1) { col = x; }
+
+    if (id) {
+      int c = f->color[col];
+      colors[n++] = c;
+      ++ends[c];
+      if (f->attached & (1u << id)) { ++attached_ends[c]; }
+    }
+
+  }
+
+  for (int c=0; c<MAX_COLORS; ++c) {
+    if (ends[c] == 1 && !(pending & (1 << c))) { return 0; }
+  }
+
+  int seen[MAX_COLORS];
+  uint8_t stack[MAX_SIZE+1];
+  size_t depth = 0;
+
+  memset(seen, 0, sizeof(seen));
+
+  for (size_t i=0; i<n; ++i) {
+
+    int c = colors[i];
+
+    if (ends[c] != 2 || attached_ends[c] != 2) { continue; }
+
+    if (seen[c]) {
+      // Second end of c must close the innermost pair still open
+      if (!depth || stack[depth-1] != c) { return 0; }
+      --depth;
+    } else {
+      seen[c] = 1;
+      stack[depth++] = c;
+    }
+
+  }
+
+  return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Generate the frontiers that can follow f once the cell at (x, y)
+// is decided: its color, and which of its right and down neighbors
+// it connects to (its left and up connections are already set by
+// f). Each move is recorded as color << 4 | direction flags of the
+// cell's connections. Colors in pending have an endpoint after
+// (x, y). Returns the number of children.
+
+size_t frontier_children(const game_info_t* info,
+                         const game_state_t* state,
+                         const frontier_t* f,
+                         size_t x, size_t y,
+                         uint16_t pending,
+                         frontier_t* children,
+                         uint8_t* moves) {
+
+  size_t size = info->size;
+  pos_t pos = pos_from_coords(x, y);
+  cell_t cell = state->cells[pos];
+
+  uint8_t left_id = x ? f->right_id : 0;
+  uint8_t up_id = f->id[x];
+
+  int left_color = x ? f->color[x-1] : -1;
+  int up_color = y ? f->color[x] : -1;
+
+  int in = (left_id != 0) + (up_id != 0);
+  int out = (cell ? 1 : 2) - in;
+
+  if (out < 0) { return 0; }
+
+  // Incoming paths and endpoints decide the color, if anything does
+  int color = -1;
+
+  if (left_id) {
+    color = left_color;
+  }
+
+  if (up_id) {
+    if (color >= 0 && color != up_color) { return 0; }
+    color = up_color;
+  }
+
+  if (cell) {
+    if (color >= 0 && color != cell_get_color(cell)) { return 0; }
+    color = cell_get_color(cell);
+  }
+
+  int min_color = color >= 0 ? color : 0;
+  int max_color = color >= 0 ? color : (int)info->num_colors - 1;
+
+  size_t n = 0;
+
+  // Bit 0 of outs connects right, bit 1 down
+  for (int outs=0; outs<4; ++outs) {
+
+    if (__builtin_popcount(outs) != out) { continue; }
+    if ((outs & 1) && x+1 == size) { continue; }
+    if ((outs & 2) && y+1 == size) { continue; }
+
+    for (int c=min_color; c<=max_color; ++c) {
+
+      if (color < 0 && (f->done & (1 << c))) { continue; }
+
+      // Same as game_can_move: neighbors of the same color must be
+      // connected to this cell
+      if (g_options.node_check_touch &&
+          ((left_color == c && !left_id) || (up_color == c && !up_id))) {
+        continue;
+      }
+
+      frontier_t* child = children + n;
+      *child = *f;
+
+      child->color[x] = c;
+      child->id[x] = 0;
+      child->right_id = 0;
+
+      int closed = 0; // Did a segment just run out of loose ends?
+
+      if (in == 2) {
+
+        if (left_id == up_id) { continue; } // would make a cycle
+
+        closed = ((f->attached & (1u << left_id)) &&
+                  (f->attached & (1u << up_id)));
+
+        frontier_relabel(child, size, up_id, left_id);
+
+      } else {
+
+        uint8_t id = in ? (left_id | up_id) : FRONTIER_NEW_ID;
+
+        if (cell && in) {
+          closed = (f->attached & (1u << id)) != 0;
+        }
+
+        if (cell) {
+          child->attached |= (1u << id);
+        } else if (!in) {
+          child->attached &= ~(1u << id);
+        }
+
+        if (outs & 1) { child->right_id = id; }
+        if (outs & 2) { child->id[x] = id; }
+
+      }
+
+      if (closed) {
+        // Both endpoints are joined, so no loose ends of this color
+        // can be left over.
+        child->done |= (1 << c);
+        if (frontier_has_color(child, size, x, c)) { continue; }
+      }
+
+      if (!frontier_viable(child, size, x, pending)) { continue; }
+
+      frontier_normalize(child, size);
+
+      moves[n] = (c << 4 |
+                  (left_id ? (1 << DIR_LEFT) : 0) |
+                  (up_id ? (1 << DIR_UP) : 0) |
+                  ((outs & 1) ? (1 << DIR_RIGHT) : 0) |
+                  ((outs & 2) ? (1 << DIR_DOWN) : 0));
+
+      ++n;
+
+    }
+
+  }
+
+  return n;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Hash a frontier for looking it up in a layer
+
+size_t frontier_hash(const frontier_t* f) {
+
+  const uint8_t* bytes = (const uint8_t*)f;
+  uint64_t hash = 14695981039346656037ULL;
+
+  for (size_t i=0; i<sizeof(frontier_t); ++i) {
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  }
+
+  return hash;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Free the memory allocated for a layer
+
+void frontier_layer_destroy(frontier_layer_t* layer) {
+  free(layer->states);
+  free(layer->counts);
+  free(layer->parents);
+  free(layer->moves);
+  free(layer->table);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Add a frontier to a layer, or if it is already there, add to the
+// number of ways to reach it. Returns 0 if out of memory.
+
+int frontier_layer_add(frontier_layer_t* layer,
+                       const frontier_t* f, uint64_t count,
+                       uint32_t parent, uint8_t move) {
+
+  // Keep the table at most half full
+  if (2*(layer->count + 1) > layer->table_size) {
+
+    size_t table_size = layer->table_size ? 2*layer->table_size : 1024;
+    uint32_t* table = calloc(table_size, sizeof(uint32_t));
+
+    if (!table) { return 0; }
+
+    for (size_t i=0; i<layer->count; ++i) {
+      size_t slot = frontier_hash(layer->states + i) & (table_size - 1);
+      while (table[slot]) { slot = (slot + 1) & (table_size - 1); }
+      table[slot] = i + 1;
+    }
+
+    free(layer->table);
+    layer->table = table;
+    layer->table_size = table_size;
+
+  }
+
+  size_t slot = frontier_hash(f) & (layer->table_size - 1);
+
+  while (layer->table[slot]) {
+    size_t i = layer->table[slot] - 1;
+    if (!memcmp(layer->states + i, f, sizeof(frontier_t))) {
+      uint64_t sum = layer->counts[i] + count;
+      layer->counts[i] = sum < count ? UINT64_MAX : sum;
+      return 1;
+    }
+    slot = (slot + 1) & (layer->table_size - 1);
+  }
+
+  if (layer->count == layer->capacity) {
+
+    size_t capacity = layer->capacity ? 2*layer->capacity : 1024;
+
+    frontier_t* states = realloc(layer->states, capacity*sizeof(frontier_t));
+    if (!states) { return 0; }
+    layer->states = states;
+
+    uint64_t* counts = realloc(layer->counts, capacity*sizeof(uint64_t));
+    if (!counts) { return 0; }
+    layer->counts = counts;
+
+    uint32_t* parents = realloc(layer->parents, capacity*sizeof(uint32_t));
+    if (!parents) { return 0; }
+    layer->parents = parents;
+
+    uint8_t* moves = realloc(layer->moves, capacity);
+    if (!moves) { return 0; }
+    layer->moves = moves;
+
+    layer->capacity = capacity;
+
+  }
+
+  size_t i = layer->count++;
+
+  layer->states[i] = *f;
+  layer->counts[i] = count;
+  layer->parents[i] = parent;
+  layer->moves[i] = move;
+  layer->table[slot] = i + 1;
+
+  return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Solve the puzzle (and count its solutions) by sweeping over the
+// cells in row-major order, keeping only the distinct frontiers: the
+// color and loose path ends along the boundary between decided and
+// undecided cells. Only the parent and move of each frontier are
+// kept for the layers already done, to recover one solution.
+
+int game_search_frontier(const game_info_t* info,
+                         const game_state_t* init_state,
+                         double* elapsed_out,
+                         size_t* nodes_out,
+                         search_stats_t* stats_out,
+                         game_state_t* final_state) {
+
+  double start = now();
+
+  size_t size = info->size;
+  size_t num_cells = size * size;
+
+  // Back pointers are kept for every layer, but whole frontiers (and
+  // their share of the hash table) only for the last and next one
+  size_t history_bytes = sizeof(uint32_t) + sizeof(uint8_t);
+  size_t live_bytes = (sizeof(frontier_t) + sizeof(uint64_t) +
+                       2*sizeof(uint32_t) + history_bytes);
+
+  size_t max_bytes = g_options.search_max_mb * MEGABYTE;
+  size_t max_states = g_options.search_max_nodes;
+
+  uint32_t* parents[num_cells];
+  uint8_t* moves[num_cells];
+
+  memset(parents, 0, sizeof(parents));
+  memset(moves, 0, sizeof(moves));
+
+  frontier_layer_t layer;
+  memset(&layer, 0, sizeof(layer));
+
+  frontier_t root;
+  memset(&root, 0, sizeof(root));
+
+  int result = SEARCH_IN_PROGRESS;
+  size_t total_states = 1;
+  size_t widest = 1;
+
+  if (!frontier_layer_add(&layer, &root, 1, 0, 0)) {
+    result = SEARCH_FULL;
+  }
+
+  for (size_t k=0; k<num_cells && result == SEARCH_IN_PROGRESS; ++k) {
+
+    size_t x = k % size, y = k / size;
+
+    uint16_t pending = 0;
+
+    for (size_t color=0; color<info->num_colors; ++color) {
+      int ix, iy, gx, gy;
+      pos_get_coords(info->init_pos[color], &ix, &iy);
+      pos_get_coords(info->goal_pos[color], &gx, &gy);
+      if ((size_t)(iy*size + ix) > k || (size_t)(gy*size + gx) > k) {
+        pending |= (1 << color);
+      }
+    }
+
+    frontier_layer_t next;
+    memset(&next, 0, sizeof(next));
+
+    for (size_t i=0; i<layer.count && result == SEARCH_IN_PROGRESS; ++i) {
+
+      frontier_t children[MAX_COLORS*4];
+      uint8_t child_moves[MAX_COLORS*4];
+
+      size_t n = frontier_children(info, init_state, layer.states + i,
+                                   x, y, pending, children, child_moves);
+
+      for (size_t j=0; j<n; ++j) {
+        size_t bytes = (total_states * history_bytes +
+                        (layer.count + next.count + 1) * live_bytes);
+        if (bytes > max_bytes ||
+            (max_states && total_states + next.count >= max_states) ||
+            !frontier_layer_add(&next, children + j, layer.counts[i],
+                                i, child_moves[j])) {
+          result = SEARCH_FULL;
+          break;
+        }
+      }
+
+    }
+
+    frontier_layer_destroy(&layer);
+
+    // Hang onto the back pointers, but not the frontiers
+    parents[k] = next.parents;
+    moves[k] = next.moves;
+    next.parents = 0;
+    next.moves = 0;
+
+    layer = next;
+    total_states += layer.count;
+    if (layer.count > widest) { widest = layer.count; }
+
+    if (!layer.count && result == SEARCH_IN_PROGRESS) {
+      result = SEARCH_UNREACHABLE;
+    }
+
+  }
+
+  uint64_t num_solutions = 0;
+  size_t solution = 0;
+
+  if (result == SEARCH_IN_PROGRESS) {
+
+    uint16_t all_done = (1 << info->num_colors) - 1;
+
+    // Every color done means no loose ends are left
+    for (size_t i=0; i<layer.count; ++i) {
+      if (layer.states[i].done == all_done) {
+        if (!num_solutions) { solution = i; }
+        uint64_t sum = num_solutions + layer.counts[i];
+        num_solutions = sum < num_solutions ? UINT64_MAX : sum;
+      }
+    }
+
+    result = num_solutions ? SEARCH_SUCCESS : SEARCH_UNREACHABLE;
+
+  }
+
+  game_state_t state = *init_state;
+
+  if (result == SEARCH_SUCCESS) {
+
+    uint8_t cell_moves[MAX_CELLS];
+
+    for (size_t k=num_cells; k-- > 0; ) {
+      size_t x = k % size, y = k / size;
+      cell_moves[pos_from_coords(x, y)] = moves[k][solution];
+      solution = parents[k][solution];
+    }
+
+    int ok = game_state_from_links(info, init_state, cell_moves, &state);
+    assert(ok);
+    (void)ok;
+
+  }
+
+  frontier_layer_destroy(&layer);
+
+  for (size_t k=0; k<num_cells; ++k) {
+    free(parents[k]);
+    free(moves[k]);
+  }
+
+  double elapsed = now() - start;
+
+  if (elapsed_out) { *elapsed_out = elapsed; }
+  if (nodes_out)   { *nodes_out = total_states; }
+  search_stats_t stats;
+  memset(&stats, 0, sizeof(stats));
+
+  // Counting is exact unless the count overflowed
+  stats.solutions = num_solutions < SIZE_MAX ? num_solutions : SIZE_MAX;
+  stats.solutions_exact = (result != SEARCH_FULL &&
+                           num_solutions < SIZE_MAX);
+
+  if (stats_out)   { *stats_out = stats; }
+
+  if (final_state) { *final_state = state; }
+
+  if (!g_options.display_quiet) {
+
+    game_print(info, init_state);
+
+    if (result == SEARCH_SUCCESS) {
+      printf("\n");
+      game_print(info, &state);
+    }
+
+    printf("\nsearch %s after %'.3f seconds with %'zu frontiers "
+           "(at most %'zu per cell)\n",
+           SEARCH_RESULT_STRINGS[result], elapsed,
+           total_states, widest);
+
+    if (result != SEARCH_FULL) {
+      search_print_count(&stats);
+    }
+
+  }
+
+  return result;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Narrow a domain to the given mask. Sets *changed if anything was
+// removed, and returns 0 if nothing is left.
+
+int cp_restrict(uint16_t* domain, uint16_t mask, int* changed) {
+
+  if (*domain & ~mask) {
+    *domain &= mask;
+    *changed = 1;
+  }
+
+  return *domain != 0;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Set up the domains for a puzzle: endpoints have their own color and
+// one connection, free cells any color and two connections, and no
+// cell connects off the board.
+
+void cp_init(const game_info_t* info,
+             const game_state_t* state,
+             cp_domains_t* cp) {
+
+  memset(cp, 0, sizeof(cp_domains_t));
+
+  uint16_t free_shapes = 0, endpoint_shapes = 0;
+
+  for (int t=0; t<SAT_NUM_DIR_TYPES; ++t) {
+    free_shapes |= (1 << SAT_DIR_TYPES[t]);
+  }
+
+  for (int dir=0; dir<4; ++dir) {
+    endpoint_shapes |= (1 << (1 << dir));
+  }
+
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+
+      pos_t pos = pos_from_coords(x, y);
+      cell_t cell = state->cells[pos];
+
+      if (cell) {
+        cp->shapes[pos] = endpoint_shapes;
+        cp->colors[pos] = (1 << cell_get_color(cell));
+      } else {
+        cp->shapes[pos] = free_shapes;
+        cp->colors[pos] = (1 << info->num_colors) - 1;
+      }
+
+      for (int dir=0; dir<4; ++dir) {
+        if (offset_pos(info, x, y, dir) == INVALID_POS) {
+          cp->shapes[pos] &= ~CP_SHAPES_WITH_DIR[dir];
+        }
+      }
+
+    }
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Propagate between neighboring cells until nothing changes: cells
+// agree on whether they connect, connected cells have the same
+// color, and (with touch checks on) unconnected neighbors have
+// different colors. Returns 0 if some domain is wiped out.
+
+int cp_propagate_local(const game_info_t* info,
+                       cp_domains_t* cp) {
+
+  int changed = 1;
+
+  while (changed) {
+
+    changed = 0;
+
+    for (size_t y=0; y<info->size; ++y) {
+      for (size_t x=0; x<info->size; ++x) {
+
+        pos_t pos = pos_from_coords(x, y);
+
+        for (int dir=0; dir<4; ++dir) {
+
+          pos_t neighbor_pos = offset_pos(info, x, y, dir);
+          if (neighbor_pos == INVALID_POS) { continue; }
+
+          uint16_t with = CP_SHAPES_WITH_DIR[dir];
+          uint16_t back = CP_SHAPES_WITH_DIR[dir ^ 1];
+
+          int may = (cp->shapes[pos] & with) != 0;
+          int must = !(cp->shapes[pos] & ~with);
+
+          uint16_t* color = cp->colors + pos;
+          uint16_t* neighbor_color = cp->colors + neighbor_pos;
+
+          if (!cp_restrict(cp->shapes + neighbor_pos,
+                           must ? back : may ? 0xffff : ~back, &changed)) {
+            return 0;
+          }
+
+          if (must &&
+              (!cp_restrict(color, *neighbor_color, &changed) ||
+               !cp_restrict(neighbor_color, *color, &changed))) {
+            return 0;
+          }
+
+          if (!(*color & *neighbor_color) &&
+              !cp_restrict(cp->shapes + pos, ~with, &changed)) {
+            return 0;
+          }
+
+          if (g_options.node_check_touch &&
+              __builtin_popcount(*color) == 1) {
+
+            if (!may &&
+                !cp_restrict(neighbor_color, ~*color, &changed)) {
+              return 0;
+            }
+
+            if (*color == *neighbor_color &&
+                !cp_restrict(cp->shapes + pos, with, &changed)) {
+              return 0;
+            }
+
+          }
+
+        }
+
+      }
+    }
+
+  }
+
+  return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Helper function for below -- find the root of a cell's set
+
+pos_t cp_find(pos_t* parent, pos_t pos) {
+
+  while (parent[pos] != pos) {
+    parent[pos] = parent[parent[pos]];
+    pos = parent[pos];
+  }
+
+  return pos;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Propagators that look at the whole board. Connections that are
+// certain may not close a cycle, and a color can only be in cells
+// reachable from its init position along possible connections
+// through cells that may have it (and its goal must be one of
+// them). Sets *changed if anything was removed, returns 0 on failure.
+
+int cp_propagate_global(const game_info_t* info,
+                        cp_domains_t* cp,
+                        int* changed) {
+
+  pos_t parent[MAX_CELLS];
+
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+      pos_t pos = pos_from_coords(x, y);
+      parent[pos] = pos;
+    }
+  }
+
+  // Right and down connections cover every edge once
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+
+      pos_t pos = pos_from_coords(x, y);
+
+      for (int i=0; i<2; ++i) {
+
+        int dir = i ? DIR_DOWN : DIR_RIGHT;
+
+        if (cp->shapes[pos] & ~CP_SHAPES_WITH_DIR[dir]) { continue; }
+
+        pos_t a = cp_find(parent, pos);
+        pos_t b = cp_find(parent, pos_offset_pos(info, pos, dir));
+
+        if (a == b) { return 0; }
+
+        parent[a] = b;
+
+      }
+
+    }
+  }
+
+  for (size_t color=0; color<info->num_colors; ++color) {
+
+    uint16_t mask = (1 << color);
+
+    pos_t queue[MAX_CELLS];
+    uint8_t visited[MAX_CELLS];
+    size_t count = 0;
+
+    memset(visited, 0, sizeof(visited));
+
+    queue[count++] = info->init_pos[color];
+    visited[info->init_pos[color]] = 1;
+
+    for (size_t i=0; i<count; ++i) {
+
+      pos_t pos = queue[i];
+
+      // Paths can't go on past the goal
+      if (pos == info->goal_pos[color]) { continue; }
+
+      for (int dir=0; dir<4; ++dir) {
+
+        if (!(cp->shapes[pos] & CP_SHAPES_WITH_DIR[dir])) { continue; }
+
+        pos_t neighbor_pos = pos_offset_pos(info, pos, dir);
+
+        if (!visited[neighbor_pos] &&
+            (cp->colors[neighbor_pos] & mask)) {
+          visited[neighbor_pos] = 1;
+          queue[count++] = neighbor_pos;
+        }
+
+      }
+
+    }
+
+    if (!visited[info->goal_pos[color]]) { return 0; }
+
+    for (size_t y=0; y<info->size; ++y) {
+      for (size_t x=0; x<info->size; ++x) {
+        pos_t pos = pos_from_coords(x, y);
+        if (!visited[pos] &&
+            !cp_restrict(cp->colors + pos, ~mask, changed)) {
+          return 0;
+        }
+      }
+    }
+
+  }
+
+  return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Helper function for below -- follow the certain connections out
+// from an endpoint, filling in path cells in the game state. Returns
+// the last path cell reached (or the endpoint itself), and sets
+// *reached if the chain ends at the goal.
+
+pos_t cp_follow_chain(const game_info_t* info,
+                      const cp_domains_t* cp,
+                      game_state_t* state,
+                      int color, pos_t pos, pos_t goal,
+                      int* reached) {
+
+  int from = -1;
+
+  *reached = 0;
+
+  while (1) {
+
+    int dir;
+
+    for (dir=0; dir<4; ++dir) {
+      if ((from < 0 || dir != (from ^ 1)) &&
+          !(cp->shapes[pos] & ~CP_SHAPES_WITH_DIR[dir])) {
+        break;
+      }
+    }
+
+    if (dir == 4) { break; }
+
+    pos_t next = pos_offset_pos(info, pos, dir);
+
+    if (next == goal) {
+      state->cells[next] = cell_create(TYPE_GOAL, color, dir);
+      *reached = 1;
+      break;
+    }
+
+    state->cells[next] = cell_create(TYPE_PATH, color, dir);
+    pos = next;
+    from = dir;
+
+  }
+
+  return pos;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Turn the certain connections into a game state, growing each color
+// from both ends as search would, so the node checks can be run on
+// it. Paths that are not attached to an endpoint are left free. Once
+// every cell is decided, this gives the solution.
+
+void cp_build_state(const game_info_t* info,
+                    const game_state_t* init_state,
+                    const cp_domains_t* cp,
+                    game_state_t* state) {
+
+  *state = *init_state;
+
+  for (size_t color=0; color<info->num_colors; ++color) {
+
+    pos_t goal = info->goal_pos[color];
+    int reached;
+
+    state->pos[color] = cp_follow_chain(info, cp, state, color,
+                                        info->init_pos[color], goal,
+                                        &reached);
+
+    if (reached) {
+      state->tail[color] = goal;
+      state->completed |= (1 << color);
+    } else {
+      state->tail[color] = cp_follow_chain(info, cp, state, color,
+                                           goal, INVALID_POS, &reached);
+    }
+
+  }
+
+  state->num_free = 0;
+
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+      if (!state->cells[pos_from_coords(x, y)]) {
+        ++state->num_free;
+      }
+    }
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Propagate until nothing changes, running the node checks on the
+// state the certain connections make as a last global propagator.
+// Returns 0 if the domains can't be completed.
+
+int cp_propagate(const game_info_t* info,
+                 const game_state_t* init_state,
+                 cp_domains_t* cp,
+                 search_stats_t* stats) {
+
+  int changed = 1;
+
+  while (changed) {
+
+    changed = 0;
+
+    if (!cp_propagate_local(info, cp) ||
+        !cp_propagate_global(info, cp, &changed)) {
+      return 0;
+    }
+
+  }
+
+  game_state_t state;
+  cp_build_state(info, init_state, cp, &state);
+
+  return !game_check_state(info, &state, CHECKS_EXPENSIVE, stats, 0, 0);
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Pick the most constrained undecided cell to branch on: the one with
+// the fewest shapes times colors. Returns INVALID_POS once the shapes
+// are all fixed, at which point propagation has fixed the colors too.
+
+pos_t cp_choose_cell(const game_info_t* info, const cp_domains_t* cp) {
+
+  pos_t best_pos = INVALID_POS;
+  int best_count = 0;
+
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+      pos_t pos = pos_from_coords(x, y);
+      int num_shapes = __builtin_popcount(cp->shapes[pos]);
+      int count = num_shapes * __builtin_popcount(cp->colors[pos]);
+      if (num_shapes > 1 &&
+          (best_pos == INVALID_POS || count < best_count)) {
+        best_pos = pos;
+        best_count = count;
+      }
+    }
+  }
+
+  return best_pos;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Count a solution, keeping it if it is the first one this search
+// found. Returns nonzero once all searches together have found
+// enough.
+
+int cp_add_solution(cp_search_t* search, const cp_domains_t* cp) {
+
+  if (!search->solutions++) { search->solution = *cp; }
+
+  size_t total = __atomic_add_fetch(search->total_solutions, 1,
+                                    __ATOMIC_RELAXED);
+
+  return total >= search->max_solutions;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Depth-first search over the domains, branching on the shape of
+// cp_choose_cell. Returns SEARCH_SUCCESS once enough solutions are
+// found (by any thread), SEARCH_FULL if out of branches, or
+// SEARCH_UNREACHABLE once the domains are exhausted.
+
+int cp_search(cp_search_t* search, const cp_domains_t* cp) {
+
+  pos_t best_pos = cp_choose_cell(search->info, cp);
+
+  if (best_pos == INVALID_POS) {
+    return cp_add_solution(search, cp) ? SEARCH_SUCCESS : SEARCH_UNREACHABLE;
+  }
+
+  uint16_t shapes = cp->shapes[best_pos];
+  int result = SEARCH_UNREACHABLE;
+
+  while (shapes && result == SEARCH_UNREACHABLE) {
+
+    if (__atomic_load_n(search->total_solutions, __ATOMIC_RELAXED) >=
+        search->max_solutions) {
+      return SEARCH_SUCCESS;
+    }
+
+    size_t branches = __atomic_add_fetch(search->total_branches, 1,
+                                         __ATOMIC_RELAXED);
+
+    if (g_options.search_max_nodes && branches > g_options.search_max_nodes) {
+      return SEARCH_FULL;
+    }
+
+    ++search->branches;
+
+    cp_domains_t child = *cp;
+    child.shapes[best_pos] = shapes & -shapes;
+    shapes &= shapes - 1;
+
+    if (cp_propagate(search->info, search->init_state,
+                     &child, &search->stats)) {
+      result = cp_search(search, &child);
+    }
+
+  }
+
+  return result;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Search subproblems from the shared list until there are none left,
+// or until some search has found enough solutions or run out.
+
+void* cp_search_run(void* arg) {
+
+  cp_search_t* search = arg;
+
+  while (search->result == SEARCH_UNREACHABLE) {
+
+    size_t i = __atomic_fetch_add(search->next_subproblem, 1,
+                                  __ATOMIC_RELAXED);
+
+    if (i >= search->num_subproblems) { break; }
+
+    search->result = cp_search(search, search->subproblems + i);
+
+  }
+
+  return NULL;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Branch breadth-first from the root domains until there are at
+// least the wanted number of subproblems, to hand out to threads.
+// Solutions found along the way are counted in search.
+
+void cp_split(cp_search_t* search, const cp_domains_t* root,
+              size_t wanted) {
+
+  size_t capacity = wanted + SAT_NUM_DIR_TYPES;
+  cp_domains_t* subproblems = malloc(capacity * sizeof(cp_domains_t));
+
+  if (!subproblems) {
+    fprintf(stderr, "out of memory splitting search!\n");
+    exit(1);
+  }
+
+  size_t first = 0, count = 0;
+  subproblems[count++] = *root;
+
+  while (first < count && count - first < wanted) {
+
+    // Branching a cell replaces one subproblem with up to six, so
+    // slide the ones left back to the start when out of room
+    if (count + SAT_NUM_DIR_TYPES > capacity) {
+      memmove(subproblems, subproblems + first,
+              (count - first) * sizeof(cp_domains_t));
+      count -= first;
+      first = 0;
+    }
+
+    cp_domains_t parent = subproblems[first++];
+    pos_t best_pos = cp_choose_cell(search->info, &parent);
+
+    if (best_pos == INVALID_POS) {
+      if (cp_add_solution(search, &parent)) { first = count; }
+      continue;
+    }
+
+    for (uint16_t shapes=parent.shapes[best_pos]; shapes; shapes &= shapes-1) {
+
+      cp_domains_t child = parent;
+      child.shapes[best_pos] = shapes & -shapes;
+
+      ++search->branches;
+      ++*search->total_branches;
+
+      if (cp_propagate(search->info, search->init_state,
+                       &child, &search->stats)) {
+        subproblems[count++] = child;
+      }
+
+    }
+
+  }
+
+  memmove(subproblems, subproblems + first,
+          (count - first) * sizeof(cp_domains_t));
+
+  search->subproblems = subproblems;
+  search->num_subproblems = count - first;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Solve the puzzle by constraint propagation: each cell has a set of
+// possible colors and a set of possible shapes (which neighbors it
+// connects to), narrowed by propagation after each branch of a
+// depth-first search. When counting solutions (see --count), the
+// search keeps going past the first one, and the domains are split
+// into subproblems for all processors to work on.
+
+int game_search_cp(const game_info_t* info,
+                   const game_state_t* init_state,
+                   double* elapsed_out,
+                   size_t* nodes_out,
+                   search_stats_t* stats_out,
+                   game_state_t* final_state) {
+
+  double start = now();
+
+  size_t total_solutions = 0;
+  size_t total_branches = 0;
+  size_t next_subproblem = 0;
+
+  cp_search_t search;
+  memset(&search, 0, sizeof(search));
+
+  search.info = info;
+  search.init_state = init_state;
+  search.total_solutions = &total_solutions;
+  search.total_branches = &total_branches;
+  search.next_subproblem = &next_subproblem;
+  search.max_solutions = g_options.search_count ? g_options.search_count : 1;
+  search.result = SEARCH_UNREACHABLE;
+
+  size_t num_threads = 1;
+
+#ifndef _WIN32
+  if (g_options.search_count && g_options.search_threads) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 1) { num_threads = cpus; }
+  }
+#endif
+
+  cp_domains_t cp;
+  cp_init(info, init_state, &cp);
+
+  if (!cp_propagate(info, init_state, &cp, &search.stats)) {
+    num_threads = 0;
+  } else if (num_threads == 1) {
+    search.result = cp_search(&search, &cp);
+    num_threads = 0;
+  } else {
+    cp_split(&search, &cp, num_threads * CP_SUBPROBLEMS_PER_THREAD);
+  }
+
+#ifndef _WIN32
+  cp_search_t workers[num_threads ? num_threads : 1];
+  pthread_t threads[num_threads ? num_threads : 1];
+  int started[num_threads ? num_threads : 1];
+
+  for (size_t t=0; t<num_threads; ++t) {
+
+    workers[t] = search;
+    workers[t].solutions = 0;
+    workers[t].branches = 0;
+    memset(&workers[t].stats, 0, sizeof(search_stats_t));
+
+    // Last one runs in this thread
+    started[t] = (t+1 < num_threads &&
+                  !pthread_create(threads + t, NULL,
+                                  cp_search_run, workers + t));
+
+    if (!started[t]) { cp_search_run(workers + t); }
+
+  }
+
+  for (size_t t=0; t<num_threads; ++t) {
+
+    const cp_search_t* worker = workers + t;
+
+    if (started[t]) { pthread_join(threads[t], NULL); }
+
+    if (worker->solutions && !search.solutions) {
+      search.solution = worker->solution;
+    }
+
+    search.solutions += worker->solutions;
+    search.branches += worker->branches;
+    search_stats_add(&search.stats, &worker->stats);
+
+    if (worker->result == SEARCH_FULL) {
+      search.result = SEARCH_FULL;
+    }
+
+  }
+#endif
+
+  free(search.subproblems);
+
+  int full = (search.result == SEARCH_FULL);
+  int result = (search.solutions ? SEARCH_SUCCESS :
+                full ? SEARCH_FULL : SEARCH_UNREACHABLE);
+
+  game_state_t state = *init_state;
+
+  if (result == SEARCH_SUCCESS) {
+    cp_build_state(info, init_state, &search.solution, &state);
+  }
+
+  search.stats.solutions = search.solutions;
+  search.stats.solutions_exact = (!full &&
+                                  search.solutions < search.max_solutions);
+
+  double elapsed = now() - start;
+
+  if (elapsed_out) { *elapsed_out = elapsed; }
+  if (nodes_out)   { *nodes_out = search.branches; }
+  if (stats_out)   { *stats_out = search.stats; }
+
+  if (final_state) { *final_state = state; }
+
+  if (!g_options.display_quiet) {
+
+    game_print(info, init_state);
+
+    if (result == SEARCH_SUCCESS) {
+      printf("\n");
+      game_print(info, &state);
+    }
+
+    printf("\nsearch %s after %'.3f seconds with %'zu branches\n",
+           SEARCH_RESULT_STRINGS[result], elapsed, search.branches);
+
+    if (g_options.search_count) {
+      search_print_count(&search.stats);
+    }
+
+  }
+
+  return result;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Peforms A* or BFS search
+
+int game_search(const game_info_t* info,
+                const game_state_t* init_state,
+                const hint_t* hint,
+                double* elapsed_out,
+                size_t* nodes_out,
+                search_stats_t* stats_out,
+                game_state_t* final_state) {
+
+  if (g_options.search_engine == ENGINE_SAT) {
+    return game_search_sat(info, init_state, elapsed_out, nodes_out,
+                           stats_out, final_state);
+  }
+
+  // Only these engines can keep going past the first solution
+  if (g_options.search_count &&
+      g_options.search_engine != ENGINE_FRONTIER) {
+    return game_search_cp(info, init_state, elapsed_out, nodes_out,
+                          stats_out, final_state);
+  }
+
+  if (g_options.search_engine == ENGINE_CP) {
+    return game_search_cp(info, init_state, elapsed_out, nodes_out,
+                          stats_out, final_state);
+  }
+
+  if (g_options.search_engine == ENGINE_FRONTIER) {
+    return game_search_frontier(info, init_state, elapsed_out, nodes_out,
+                                stats_out, final_state);
+  }
+
+  double dlx_elapsed = 0;
+  size_t dlx_nodes = 0;
+
+  if (g_options.search_engine == ENGINE_DLX) {
+
+    int result = game_search_dlx(info, init_state, &dlx_elapsed,
+                                 &dlx_nodes, stats_out, final_state);
+
+    if (result != SEARCH_FULL) {
+      if (elapsed_out) { *elapsed_out = dlx_elapsed; }
+      if (nodes_out)   { *nodes_out = dlx_nodes; }
+      return result;
+    }
+
+    if (!g_options.display_quiet) {
+      printf("falling back to search\n\n");
+    }
+    
+  }
+
+  size_t max_nodes = g_options.search_max_nodes;
+
+  if (!max_nodes) {
+    max_nodes = floor( g_options.search_max_mb * MEGABYTE /
+                       sizeof(tree_node_t) );
+  }
+
+  node_storage_t storage;
+  queue_t q;
+
+  search_memory_get(max_nodes, &storage, &q);
+
+  if (!g_options.display_quiet) {
+    
+    printf("will search up to %'zu nodes (%'.2f MB)\n",
+           max_nodes, max_nodes*(double)sizeof(tree_node_t)/MEGABYTE);
+  
+    printf("%s heuristic at start is %'g\n\n",
+           HEURISTIC_STRINGS[g_options.search_heuristic],
+           game_heuristic(info, init_state));
+
+    game_print(info, init_state);
+
+  }
+
+  const tree_node_t* solution_node = NULL;
+
+  // Nogoods only hold for the puzzle they were found in
+  memset(g_nogoods, 0, sizeof(g_nogoods));
+
+  search_stats_t stats;
+  memset(&stats, 0, sizeof(stats));
+
+  double start = now();
+
+  int anytime = g_options.search_anytime && g_options.search_best_first;
+
+  int result;
+  size_t restart_nodes = 0;
+
+  if (g_options.search_restart_unit) {
+    result = game_search_restarts(info, init_state, hint,
+                                  &storage, &q, &stats, anytime,
+                                  &solution_node, &restart_nodes);
+  } else {
+    result = game_search_core(info, init_state, hint,
+                              &storage, &q, &stats, anytime,
+                              &solution_node);
+  }
+
+  double elapsed = now() - start;
+  if (elapsed_out) { *elapsed_out = elapsed + dlx_elapsed; }
+  if (nodes_out)   {
+    *nodes_out = (dlx_nodes + restart_nodes +
+                  storage.count + stats.subsearch_nodes);
+  }
+  if (stats_out)   { *stats_out = stats; }
+  
+
+  if (!g_options.display_quiet) {
+  
+    if (result == SEARCH_SUCCESS) {
+      assert(solution_node);
+      if (!g_options.display_animate) {
+        printf("\n");
+        game_print(info, &solution_node->state);
+      } else {
+        if (elapsed < 1.0) {
+          delay_seconds(1.0 - elapsed);
+        }
+        game_animate_solution(info, solution_node);
+        delay_seconds(1.0);
+      }
+    } 
+
+    double storage_mb = (storage.count * (double)sizeof(tree_node_t) / MEGABYTE);
+
+    printf("\nsearch %s after %'.3f seconds and %'zu nodes (%'.2f MB)\n",
+           SEARCH_RESULT_STRINGS[result],
+           elapsed,
+           storage.count, storage_mb);
+
+    double check_time = 0;
+    
+    for (int i=0; i<NUM_CHECKS; ++i) {
+      check_time += stats.check_time[i];
+    }
+
+    printf("node checks took %'.3f seconds:", check_time);
+    
+    for (int i=0; i<NUM_CHECKS; ++i) {
+      printf("%s %s %'.3f (%'zu pruned)", i ? "," : "",
+             CHECK_STRINGS[i], stats.check_time[i], stats.pruned[i]);
+    }
+    
+    printf("\n");
+
+    if (g_options.search_partial_expansion && g_options.search_best_first) {
+      printf("partial expansion re-queued %'zu nodes\n", stats.requeued);
+    }
+
+    if (stats.splits) {
+      printf("split into independent subproblems %'zu times "
+             "(%'zu more nodes)\n", stats.splits, stats.subsearch_nodes);
+    }
+
+    if (stats.nogoods_stored || stats.nogoods_pruned) {
+      printf("stored %'zu unsolvable subproblems, which pruned %'zu more\n",
+             stats.nogoods_stored, stats.nogoods_pruned);
+    }
+
+    if (stats.symmetric_pruned) {
+      printf("skipped %'zu moves mirroring others on a symmetric board\n",
+             stats.symmetric_pruned);
+    }
+
+    if (stats.restarts) {
+      printf("restarted %'zu times (%'zu more nodes)\n",
+             stats.restarts, restart_nodes);
+    }
+
+    for (size_t i=0; i<stats.num_rounds; ++i) {
+      const search_round_t* round = stats.rounds + i;
+      printf("anytime search with weight %'g: best cost %'g after "
+             "%'.3f seconds and %'zu nodes\n",
+             round->weight, round->cost, round->elapsed, round->nodes);
+    }
+
+    if (result == SEARCH_SUCCESS) {
+    
+      assert(solution_node);
+
+      printf("final cost to come=%'g, cost to go=%'g\n",
+             solution_node->cost_to_come,
+             solution_node->cost_to_go);
+
+    } else if (result == SEARCH_FULL && g_options.display_diagnostics) {
+
+      printf("here's the lowest cost thing on the queue:\n");
+
+      game_diagnostics(info, queue_peek(&q));
+
+      printf("\nand here's the last node allocated:\n");
+
+      game_diagnostics(info, storage.start+storage.count-1);
+      
+    }
+
+  }
+
+  if (final_state) {
+    if (result == SEARCH_SUCCESS) {
+      assert(solution_node);
+      *final_state = solution_node->state;
+    } else if (storage.count) {
+      *final_state = storage.start[storage.count-1].state;
+    } else {
+      *final_state = *init_state;
+    }
+  }
+
+  return result;
+  
+}
+
+//////////////////////////////////////////////////////////////////////
+// Fill in the path of one color from a previous solution, given as
+// the color of each cell (as read by game_read_hint), by following
+// it from the initial position to the goal. Returns 0 if the cells
+// of that color don't make a single path between the color's
+// current endpoints through free cells.
+
+int game_place_path(const game_info_t* info,
+                    game_state_t* state,
+                    int color,
+                    const uint8_t prev[MAX_CELLS]) {
+
+  pos_t init_pos = info->init_pos[color];
+  pos_t goal_pos = info->goal_pos[color];
+
+  if (prev[init_pos] != color || prev[goal_pos] != color) {
+    return 0;
+  }
+
+  size_t num_cells = 0;
+
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+      num_cells += (prev[pos_from_coords(x, y)] == color);
+    }
+  }
+
+  pos_t pos = init_pos;
+  int from = -1;
+  size_t length = 1;
+
+  while (pos != goal_pos) {
+
+    int next_dir = -1;
+
+    for (int dir=0; dir<4; ++dir) {
+
+      pos_t next = pos_offset_pos(info, pos, dir);
+
+      if (next == INVALID_POS || prev[next] != color ||
+          (from >= 0 && dir == (from ^ 1))) {
+        continue;
+      }
+
+      if (next == goal_pos) {
+        next_dir = dir;
+        break;
+      } else if (next_dir >= 0) {
+        return 0; // path branches
+      }
+
+      next_dir = dir;
+
+    }
+
+    if (next_dir < 0) { return 0; }
+
+    state->pos[color] = pos;
+    pos = pos_offset_pos(info, pos, next_dir);
+    from = next_dir;
+    ++length;
+
+    if (pos == goal_pos) {
+      state->cells[pos] = cell_create(TYPE_GOAL, color, next_dir);
+    } else if (state->cells[pos] || length > num_cells) {
+      return 0;
+    } else {
+      state->cells[pos] = cell_create(TYPE_PATH, color, next_dir);
+      --state->num_free;
+    }
+
+  }
+
+  if (length != num_cells) {
+    return 0;
+  }
+
+  state->tail[color] = goal_pos;
+  state->completed |= (1 << color);
+
+  return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Re-solve an edited puzzle starting from a solution of the earlier
+// version: every color whose old path still joins its endpoints is
+// kept as is, and only the rest of the board is searched. If that
+// fails, the kept colors bordering the searched region are freed up
+// too, and so on until the search succeeds or nothing is kept, which
+// is the same as searching from scratch.
+
+int game_search_warm(const game_info_t* info,
+                     const game_state_t* init_state,
+                     const uint8_t prev[MAX_CELLS],
+                     double* elapsed_out,
+                     size_t* nodes_out,
+                     search_stats_t* stats_out,
+                     game_state_t* final_state) {
+
+  uint16_t kept = 0;
+
+  for (size_t color=0; color<info->num_colors; ++color) {
+    game_state_t state = *init_state;
+    if (game_place_path(info, &state, color, prev)) {
+      kept |= (1 << color);
+    }
+  }
+
+  double elapsed = 0;
+  size_t nodes = 0;
+
+  // Totals over every search but the last
+  search_stats_t earlier;
+  memset(&earlier, 0, sizeof(earlier));
+
+  search_stats_t stats;
+  int result;
+
+  for (;;) {
+
+    game_state_t state = *init_state;
+    size_t num_kept = 0;
+
+    for (size_t color=0; color<info->num_colors; ++color) {
+      if (kept & (1 << color)) {
+        game_place_path(info, &state, color, prev);
+        ++num_kept;
+      }
+    }
+
+    if (!g_options.display_quiet) {
+      printf("warm start keeping %zu of %zu colors from the previous "
+             "solution\n\n", num_kept, info->num_colors);
+    }
+
+    double stage_elapsed;
+    size_t stage_nodes;
+
+    if (state.num_free == 0 &&
+        state.completed == (1 << info->num_colors) - 1) {
+
+      // Nothing changed, and search only looks for solved children
+      if (final_state) { *final_state = state; }
+
+      if (!g_options.display_quiet) {
+        game_print(info, &state);
+        printf("\nsearch %s from the previous solution\n",
+               SEARCH_RESULT_STRINGS[SEARCH_SUCCESS]);
+      }
+
+      memset(&stats, 0, sizeof(stats));
+      search_stats_add(&stats, &earlier);
+      result = SEARCH_SUCCESS;
+      break;
+
+    }
+
+    result = game_search(info, &state, 0, &stage_elapsed, &stage_nodes,
+                         &stats, final_state);
+
+    elapsed += stage_elapsed;
+    nodes += stage_nodes;
+
+    if (result != SEARCH_UNREACHABLE || !kept) {
+      search_stats_add(&stats, &earlier);
+      break;
+    }
+
+    search_stats_add(&earlier, &stats);
+
+    // Free up the kept colors next to anything that isn't kept
+    uint16_t border = 0;
+
+    for (size_t y=0; y<info->size; ++y) {
+      for (size_t x=0; x<info->size; ++x) {
+
+        pos_t pos = pos_from_coords(x, y);
+        cell_t cell = state.cells[pos];
+
+        if (cell && (kept & (1 << cell_get_color(cell)))) {
+          continue;
+        }
+
+        for (int dir=0; dir<4; ++dir) {
+          pos_t neighbor_pos = pos_offset_pos(info, pos, dir);
+          cell_t neighbor = (neighbor_pos == INVALID_POS ? 0 :
+                             state.cells[neighbor_pos]);
+          if (neighbor) {
+            border |= (1 << cell_get_color(neighbor));
+          }
+        }
+
+      }
+    }
+
+    border &= kept;
+    kept = border ? (kept & ~border) : 0;
+
+    if (!g_options.display_quiet) {
+      printf("\n");
+    }
+
+  }
+
+  if (elapsed_out) { *elapsed_out = elapsed; }
+  if (nodes_out)   { *nodes_out = nodes; }
+  if (stats_out)   { *stats_out = stats; }
+
+  return result;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Find the canonical form of a puzzle: of the 8 symmetric versions
+// of the board, the one that comes first when each endpoint is
+// written as 1 + the order its color first appears in, reading
+// row by row (and free cells as 0). Sets *sym_out to the symmetry
+// that gives it, and canon_color[c] to the canonical label of color
+// c. Returns a hash of the canonical form, which is never 0.
+
+uint64_t game_canonicalize(const game_info_t* info,
+                           const game_state_t* state,
+                           uint8_t canon[MAX_SIZE*MAX_SIZE],
+                           int* sym_out,
+                           uint8_t canon_color[MAX_COLORS]) {
+
+  size_t size = info->size;
+  size_t num_cells = size * size;
+
+  for (int sym=0; sym<8; ++sym) {
+
+    uint8_t colors[MAX_SIZE*MAX_SIZE];
+    uint8_t labels[MAX_COLORS];
+    uint8_t num_labels = 0;
+
+    memset(colors, 0, sizeof(colors));
+    memset(labels, 0, sizeof(labels));
+
+    for (size_t y=0; y<size; ++y) {
+      for (size_t x=0; x<size; ++x) {
+        cell_t cell = state->cells[pos_from_coords(x, y)];
+        int sx, sy;
+        sym_coords(size, sym, x, y, &sx, &sy);
+        colors[sy*size + sx] = cell ? cell_get_color(cell) + 1 : 0;
+      }
+    }
+
+    for (size_t i=0; i<num_cells; ++i) {
+      if (colors[i]) {
+        uint8_t* label = labels + colors[i] - 1;
+        if (!*label) { *label = ++num_labels; }
+        colors[i] = *label;
+      }
+    }
+
+    if (!sym || memcmp(colors, canon, num_cells) < 0) {
+      memcpy(canon, colors, num_cells);
+      *sym_out = sym;
+      for (size_t c=0; c<info->num_colors; ++c) {
+        canon_color[c] = labels[c] - 1;
+      }
+    }
+
+  }
+
+  // Solutions without the touch rule don't do for searches with it
+  uint64_t hash = 14695981039346656037ULL;
+
+  hash = (hash ^ size) * 1099511628211ULL;
+  hash = (hash ^ g_options.node_check_touch) * 1099511628211ULL;
+
+  for (size_t i=0; i<num_cells; ++i) {
+    hash = (hash ^ canon[i]) * 1099511628211ULL;
+  }
+
+  return hash ? hash : 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Open the solution cache file, creating it if needed, and map it
+// into memory. Returns 0 (with a warning) if it can't be used.
+
+int cache_open(solution_cache_t* cache, const char* filename) {
+
+  memset(cache, 0, sizeof(solution_cache_t));
+
+#ifndef _WIN32
+
+  size_t bytes = sizeof(cache_header_t) + CACHE_SLOTS*sizeof(cache_slot_t);
+
+  int fd = open(filename, O_RDWR | O_CREAT, 0644);
+
+  struct stat st;
+
+  if (fd < 0 || fstat(fd, &st)) {
+    fprintf(stderr, "error opening solution cache %s\n", filename);
+    if (fd >= 0) { close(fd); }
+    return 0;
+  }
+
+  int fresh = (st.st_size == 0);
+
+  if ((fresh && ftruncate(fd, bytes)) ||
+      (!fresh && (size_t)st.st_size != bytes)) {
+    fprintf(stderr, "%s is not a solution cache, ignoring it\n", filename);
+    close(fd);
+    return 0;
+  }
+
+  void* data = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+
+  close(fd);
+
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "error mapping solution cache %s\n", filename);
+    return 0;
+  }
+
+  cache_header_t* header = data;
+
+  if (fresh) {
+    memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+    header->num_slots = CACHE_SLOTS;
+    header->slot_size = sizeof(cache_slot_t);
+  } else if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) ||
+             header->num_slots != CACHE_SLOTS ||
+             header->slot_size != sizeof(cache_slot_t)) {
+    fprintf(stderr, "%s is not a solution cache, ignoring it\n", filename);
+    munmap(data, bytes);
+    return 0;
+  }
+
+  cache->header = header;
+  cache->slots = (cache_slot_t*)(header + 1);
+  cache->bytes = bytes;
+
+  return 1;
+
+#else
+
+  fprintf(stderr, "solution cache not supported, ignoring %s\n", filename);
+  return 0;
+
+#endif
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Unmap the solution cache, which writes it back to disk.
+
+void cache_close(solution_cache_t* cache) {
+
+#ifndef _WIN32
+  if (cache->header) {
+    munmap(cache->header, cache->bytes);
+  }
+#endif
+
+  memset(cache, 0, sizeof(solution_cache_t));
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Look up the solution of a puzzle. Returns 1 and fills in solution
+// on a hit. A slot only counts as a hit if the endpoints of its
+// solution are those of the canonical puzzle, so hash collisions
+// can't give wrong answers.
+
+int cache_lookup(const solution_cache_t* cache,
+                 const game_info_t* info,
+                 const game_state_t* init_state,
+                 game_state_t* solution) {
+
+  if (!cache->header) { return 0; }
+
+  uint8_t canon[MAX_SIZE*MAX_SIZE];
+  uint8_t canon_color[MAX_COLORS];
+  int sym;
+
+  uint64_t key = game_canonicalize(info, init_state, canon, &sym, canon_color);
+
+  size_t size = info->size;
+  size_t num_cells = size * size;
+
+  for (size_t probe=0; probe<CACHE_MAX_PROBES; ++probe) {
+
+    const cache_slot_t* slot = cache->slots + (key + probe) % CACHE_SLOTS;
+
+    if (!slot->key) { return 0; }
+    if (slot->key != key || slot->size != size) { continue; }
+
+    int match = 1;
+
+    for (size_t i=0; i<num_cells && match; ++i) {
+      int endpoint = __builtin_popcount(slot->links[i] & 0xf) == 1;
+      match = (endpoint ? (slot->links[i] >> 4) + 1 : 0) == canon[i];
+    }
+
+    if (!match) { continue; }
+
+    // Map the links back from the canonical board
+    uint8_t color_of_label[MAX_COLORS];
+    uint8_t links[MAX_CELLS];
+
+    for (size_t c=0; c<info->num_colors; ++c) {
+      color_of_label[canon_color[c]] = c;
+    }
+
+    for (size_t y=0; y<size; ++y) {
+      for (size_t x=0; x<size; ++x) {
+        int sx, sy;
+        sym_coords(size, sym, x, y, &sx, &sy);
+        uint8_t link = slot->links[sy*size + sx];
+        uint8_t flags = 0;
+        if ((link >> 4) >= info->num_colors) { return 0; }
+        for (int dir=0; dir<4; ++dir) {
+          if (link & sym_dir_flags(sym, 1 << dir)) { flags |= (1 << dir); }
+        }
+        links[pos_from_coords(x, y)] = (color_of_label[link >> 4] << 4 |
+                                        flags);
+      }
+    }
+
+    return game_state_from_links(info, init_state, links, solution);
+
+  }
+
+  return 0;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Store the solution of a puzzle in its canonical form, in the first
+// free slot or the one already holding it, or else over the first
+// slot it could go in.
+
+void cache_store(solution_cache_t* cache,
+                 const game_info_t* info,
+                 const game_state_t* init_state,
+                 const game_state_t* solution) {
+
+  if (!cache->header) { return; }
+
+  uint8_t canon[MAX_SIZE*MAX_SIZE];
+  uint8_t canon_color[MAX_COLORS];
+  int sym;
+
+  uint64_t key = game_canonicalize(info, init_state, canon, &sym, canon_color);
+
+  cache_slot_t* slot = cache->slots + key % CACHE_SLOTS;
+
+  for (size_t probe=0; probe<CACHE_MAX_PROBES; ++probe) {
+    cache_slot_t* s = cache->slots + (key + probe) % CACHE_SLOTS;
+    if (!s->key || (s->key == key && s->size == info->size)) {
+      slot = s;
+      break;
+    }
+  }
+
+  uint8_t links[MAX_CELLS];
+  game_state_links(info, solution, links);
+
+  memset(slot, 0, sizeof(cache_slot_t));
+
+  for (size_t y=0; y<info->size; ++y) {
+    for (size_t x=0; x<info->size; ++x) {
+      int sx, sy;
+      sym_coords(info->size, sym, x, y, &sx, &sy);
+      uint8_t link = links[pos_from_coords(x, y)];
+      slot->links[sy*info->size + sx] = (canon_color[link >> 4] << 4 |
+                                         sym_dir_flags(sym, link & 0xf));
+    }
+  }
+
+  slot->size = info->size;
+  slot->key = key;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Command line usage
+
+void usage(FILE* fp, int exitcode) {
+
+  fprintf(fp,
+          "usage: flow_solver [ OPTIONS ] [ -H HINT1.txt ] "
+          "[ -o ORDER1 ] BOARD1.txt\n"
+          "                   [ [ -H HINT2.txt ] [ -o ORDER2 ] "
+          "BOARD2.txt [ ... ] ]\n\n"
+          "Display options:\n\n"
+          "  -q, --quiet             Reduce output\n"
+          "  -D, --diagnostics       Print diagnostics when search unsuccessful\n"
+          "  -A, --no-animation      Disable animating solution\n"
+          "  -F, --fast              Speed up animation 4x\n"
+#ifndef _WIN32          
+          "  -C, --color             Force use of ANSI color\n"
+#endif
+          "  -S, --svg               Output final state to SVG\n"
+          "\n"
+          "Node evaluation options:\n\n"
+          "  -t, --touch             Disable path self-touch test\n"
+          "  -s, --stranded          Disable stranded checking\n"
+          "  -d, --deadends          Disable dead-end checking\n"
+          "  -M, --matching          Disable color/region matching checking\n"
+          "  -p, --parity            Disable checkerboard parity checking\n"
+          "  -R, --reach             Disable reachability and path length checking\n"
+          "  -x, --domains           Disable cell color domain checking\n"
+          "  -b, --bottlenecks N     Set bottleneck limit check (default %d)\n"
+          "  -e, --no-explore        Penalize exploring away from walls\n"
+          "  -L, --lazy              Defer expensive checks until nodes are dequeued\n"
+          "\n"
+          "Color ordering options:\n\n"
+          "  -a, --no-autosort       Disable auto-sort of color order\n"
+          "  -r, --randomize         Shuffle order of colors before solving\n"
+          "  -z, --seed N            Seed for shuffling (default from clock)\n"
+          "  -f, --forced            Disable ordering forced moved first\n"
+          "  -c, --constrained       Disable order by most constrained\n"
+          "\n"
+          "Search options:\n\n"
+          "  -O, --no-outside-in     Disable outside-in searching\n"
+          "  -B, --breadth-first     Breadth-first search instead of best-first\n"
+          "  -n, --max-nodes N       Restrict storage to N nodes\n"
+          "  -m, --max-storage N     Restrict storage to N MB (default %'g)\n"
+          "  -Q, --queue-always      Disable \"fast-forward\" queue bypassing\n"
+          "  -P, --partial-expansion Only store children as cheap as their parent\n"
+          "  -K, --no-corridors      Don't follow corridors as single macro-moves\n"
+          "  -I, --no-split          Don't split into independent subproblems\n"
+          "  -N, --no-nogoods        Don't remember unsolvable subproblems\n"
+          "  -Y, --no-symmetry       Don't skip moves mirroring earlier ones on\n"
+          "                          symmetric boards\n"
+          "  -E, --both-ends         Grow paths from whichever end is more constrained\n"
+#ifndef _WIN32
+          "  -T, --no-threads        Search independent subproblems one at a time\n"
+#endif
+          "  -u, --heuristic NAME    Set heuristic: free, dist, or regions\n"
+          "                          (default %s); dist and regions\n"
+          "                          overestimate, so they only rank states\n"
+          "                          and can make -W prune better solutions\n"
+          "  -w, --weight W          Weight cost to go by W >= 1 (default %'g)\n"
+          "  -W, --anytime           Keep improving the solution while lowering\n"
+          "                          the weight (starts at %d unless -w is bigger)\n"
+          "  -y, --restarts N        Restart with a new color and move order\n"
+          "                          after N times the Luby sequence nodes\n"
+          "\n"
+          "Engine options:\n\n"
+          "  -g, --engine NAME       Solve with search, sat, dlx (exact cover of\n"
+          "                          paths), frontier (row-by-row dynamic\n"
+          "                          programming), or cp (constraint\n"
+          "                          propagation) (default %s)\n"
+          "  -X, --sat               Same as --engine sat (with -n, N limits\n"
+          "                          conflicts instead of nodes)\n"
+          "  -k, --max-paths N       Fall back on search if dlx finds more than\n"
+          "                          N paths, or takes too long finding them\n"
+          "                          (default %'zu)\n"
+          "  -l, --count N           Count solutions, stopping at N, with cp\n"
+          "                          (in parallel) or frontier (exactly)\n"
+          "  -U, --unique            Same as --count 2, to check uniqueness\n"
+#ifndef _WIN32
+          "  -J, --cache FILE        Look up solutions in FILE before solving,\n"
+          "                          and save new ones there (rotated, mirrored\n"
+          "                          and recolored puzzles all match)\n"
+#endif
+          "\n"
+          "Options affecting the next input file:\n\n"
+          "  -o, --order ORDER       Set color order on command line\n"
+          "  -H, --hint HINTFILE     Provide hint for previous board (may be\n"
+          "                          given more than once). Moves that disagree\n"
+          "                          with it cost more instead of being ruled out\n"
+          "  -G, --hint-weight W     Extra cost per disagreement for the hint\n"
+          "                          files after this (default 1)\n"
+          "  -V, --warm SOLFILE      Re-solve the next board keeping the paths\n"
+          "                          that still fit from a solution of an\n"
+          "                          earlier version of it (search engine only)\n"
+          "\n"
+#ifndef _WIN32
+          "Server options:\n\n"
+          "  -i, --serve             Solve puzzles sent as JSON lines on stdin,\n"
+          "                          writing results as JSON lines to stdout\n"
+          "  -j, --socket PATH       With --serve, take requests from connections\n"
+          "                          to a Unix socket at PATH instead\n"
+          "\n"
+#endif
+          "Help:\n\n"
+          "  -h, --help              See this help text\n\n",
+          g_options.node_bottleneck_limit,
+          g_options.search_max_mb,
+          HEURISTIC_STRINGS[g_options.search_heuristic],
+          g_options.search_weight,
+          ANYTIME_WEIGHT,
+          ENGINE_STRINGS[g_options.search_engine],
+          g_options.search_max_paths);
+
+  exit(exitcode);
+  
+}
+
+//////////////////////////////////////////////////////////////////////
+// Check file exists
+
+int exists(const char* fn) {
+
+  FILE* fp = fopen(fn, "r");
+  
+  if (fp) {
+    fclose(fp);
+    return 1;
+  } else {
+    return 0;
+  }
+
+}
+
+//////////////////////////////////////////////////////////////////////
+//
+
+const char* get_argument(int argc, char** argv, int* i) {
+
+  assert(*i < argc);
+  
+  if ((*i)+1 == argc) {
+    fprintf(stderr, "%s needs argument\n", argv[*i]);
+    usage(stderr, 1);
+  }
+
+  return argv[++(*i)];
+  
+  
+}
+
+//////////////////////////////////////////////////////////////////////
+// Input files collected by parse_options, along with the options
+// that apply to each of them.
+
+typedef struct inputs_struct {
+  const char** input_files;
+  const char** user_orders;
+  hint_file_t* hint_files;
+  const char** warm_files;
+  size_t num_inputs;
+  size_t num_hints;
+  double hint_weight;   // Weight for the next hint file
+} inputs_t;
+
+//////////////////////////////////////////////////////////////////////
+// Parse the option at argv[*i], leaving *i at its argument if it
+// takes one. Options for input files, and the ones that only make
+// sense once per run, are only accepted if inputs is non-null.
+// Returns 1 if the option was parsed, 0 (after printing why) if it
+// was invalid, or -1 if argv[*i] is not an option.
+
+int parse_option(int argc, char** argv, int* i, inputs_t* inputs) {
+
+  typedef struct flag_options_struct {
+    int short_char;
+    const char* long_string;
+    int* dst_flag;
+    int dst_value;
+  } flag_options_t;
+
+  flag_options_t options[] = {
+    { 'q', "quiet",         &g_options.display_quiet, 1 },
+    { 'D', "diagnostics",   &g_options.display_diagnostics, 1 },
+    { 'A', "animation",     &g_options.display_animate, 0 },
+#ifndef _WIN32    
+    { 'C', "color",         &g_options.display_color, 1 },
+#endif
+    { 'F', "fast",          &g_options.display_fast, 1 },
+    { 'S', "svg",           &g_options.display_save_svg, 1 },
+    { 't', "touch",         &g_options.node_check_touch, 0 },
+    { 's', "stranded",      &g_options.node_check_stranded, 0 },
+    { 'd', "deadends",      &g_options.node_check_deadends, 0 },
+    { 'M', "matching",      &g_options.node_check_matching, 0 },
+    { 'p', "parity",        &g_options.node_check_parity, 0 },
+    { 'R', "reach",         &g_options.node_check_distance, 0 },
+    { 'x', "domains",       &g_options.node_check_domains, 0 },
+    { 'b', "bottlenecks",   0, 0 },
+    { 'e', "no-explore",    &g_options.node_penalize_exploration, 1 },
+    { 'L', "lazy",          &g_options.node_lazy_checks, 1 },
+    { 'a', "no-autosort",   &g_options.order_autosort_colors, 0 },
+    { 'o', "order",         0, 0 },
+    { 'r', "randomize",     &g_options.order_random, 1 },
+    { 'z', "seed",          0, 0 },
+    { 'f', "forced",        &g_options.order_forced_first, 0 },
+    { 'c', "constrained",   &g_options.order_most_constrained, 0 },
+    { 'O', "no-outside-in", &g_options.search_outside_in, 0 },
+    { 'B', "breadth-first", &g_options.search_best_first, 0 },
+    { 'Q', "queue-always",  &g_options.search_fast_forward, 0 },
+    { 'P', "partial-expansion", &g_options.search_partial_expansion, 1 },
+    { 'K', "no-corridors",  &g_options.search_corridors, 0 },
+    { 'I', "no-split",      &g_options.search_split, 0 },
+    { 'N', "no-nogoods",    &g_options.search_nogoods, 0 },
+    { 'Y', "no-symmetry",   &g_options.search_symmetry, 0 },
+    { 'X', "sat",           &g_options.search_engine, ENGINE_SAT },
+    { 'g', "engine",        0, 0 },
+    { 'k', "max-paths",     0, 0 },
+    { 'l', "count",         0, 0 },
+    { 'U', "unique",        &g_options.search_count, 2 },
+#ifndef _WIN32
+    { 'J', "cache",         0, 0 },
+#endif
+    { 'E', "both-ends",     &g_options.search_both_ends, 1 },
+#ifndef _WIN32
+    { 'T', "no-threads",    &g_options.search_threads, 0 },
+#endif
+    { 'u', "heuristic",     0, 0 },
+    { 'w', "weight",        0, 0 },
+    { 'W', "anytime",       &g_options.search_anytime, 1 },
+    { 'y', "restarts",      0, 0 },
+    { 'n', "max-nodes",     0, 0 },
+    { 'm', "max-storage",   0, 0 },
+    { 'H', "hint",          0, 0 },
+    { 'G', "hint-weight",   0, 0 },
+    { 'V', "warm",          0, 0 },
+#ifndef _WIN32
+    { 'i', "serve",         &g_options.serve, 1 },
+    { 'j', "socket",        0, 0 },
+#endif
+    { 'h', "help",          0, 0 },
+    { 0, 0, 0, 0 }
+  };
+
+  const char* opt = argv[*i];
+  int match_id = -1;
 
-  printf("node has cost to come %'g and cost to go %'g\n",
-         node->cost_to_come, node->cost_to_go);
+  for (int k=0; options[k].short_char; ++k) {
 
-  if (node->state.last_color < info->num_colors) {
-    printf("last move was for color %s\n",
-           color_name_str(info, node->state.last_color));
+    if (options[k].short_char > 0) {
+      char cur_short[3] = "-?";
+      cur_short[1] = options[k].short_char;
+      if (!strcmp(opt, cur_short)) {
+        match_id = k;
+        break;
+      }
+    }
+
+    if (options[k].long_string) {
+      char cur_long[1024];
+      snprintf(cur_long, 1024, "--%s", options[k].long_string);
+      if (!strcmp(opt, cur_long)) {
+        match_id = k;
+        break;
+      }
+    }
 
-  } else {
-    printf("no moves yet?\n");
   }
 
-  game_state_t state_copy = node->state;
+  if (match_id < 0) {
+    return -1;
+  }
 
-  int forced = 1;
+  int match_short_char = options[match_id].short_char;
+
+  if (!inputs && strchr("oHGVJhij", match_short_char)) {
+    fprintf(stderr, "%s is only allowed on the command line\n", opt);
+    return 0;
+  }
+
+  if (!options[match_id].dst_flag && match_short_char != 'h' &&
+      (*i)+1 == argc) {
+    fprintf(stderr, "%s needs argument\n", opt);
+    return 0;
+  }
+
+  if (options[match_id].dst_flag) {
+    
+    *options[match_id].dst_flag = options[match_id].dst_value;
+
+  } else if (match_short_char == 'b') {
+            
+    opt = get_argument(argc, argv, i);
   
-  while (forced) {
+    char* endptr;
+    g_options.node_bottleneck_limit = strtol(opt, &endptr, 10);
+  
+    if (!endptr || *endptr) {
+      fprintf(stderr, "error parsing bottleneck limit %s "
+              "on command line!\n\n", opt);
+      return 0;
+    }
 
-    printf("game state:\n\n");
-    game_print(info, &state_copy);
-    printf("\n");
+  } else if (match_short_char == 'n') {
+
+    opt = get_argument(argc, argv, i);
+  
+    char* endptr;
+    g_options.search_max_nodes = strtol(opt, &endptr, 10);
+  
+    if (!endptr || *endptr) {
+      fprintf(stderr, "error parsing max nodes %s "
+              "on command line!\n\n", opt);
+      return 0;
+    }
+
+  } else if (match_short_char == 'm') {
+
+    opt = get_argument(argc, argv, i);
     
-    uint8_t rmap[MAX_CELLS];
+    char* endptr;
+    g_options.search_max_mb = strtod(opt, &endptr);
+    
+    if (!endptr || *endptr || g_options.search_max_mb <= 0) {
+      fprintf(stderr, "error parsing max storage %s "
+              "on command line!\n\n", opt);
+      return 0;
+    }
+    
+  } else if (match_short_char == 'u') {
 
-    size_t rcount = game_build_regions(info, &state_copy, rmap);
+    opt = get_argument(argc, argv, i);
 
-    if (game_check_deadends(info, &state_copy)) {
-      printf("dead-ended -- state should be pruned!\n");
-      printf("game regions:\n\n");
-      game_print_regions(info, &state_copy, rmap);
-      break;
+    int h;
+    
+    for (h=0; h<NUM_HEURISTICS; ++h) {
+      if (!strcmp(opt, HEURISTIC_STRINGS[h])) { break; }
     }
+
+    if (h == NUM_HEURISTICS) {
+      fprintf(stderr, "unrecognized heuristic %s "
+              "on command line!\n\n", opt);
+      return 0;
+    }
+
+    g_options.search_heuristic = h;
+
+  } else if (match_short_char == 'g') {
+
+    opt = get_argument(argc, argv, i);
+
+    int e;
     
-    if (game_regions_stranded(info, &state_copy, rcount, rmap, MAX_COLORS, 1)) {
-      printf("stranded -- state should be pruned!\n");
-      printf("game regions:\n\n");
-      game_print_regions(info, &state_copy, rmap);
-      break;
+    for (e=0; e<NUM_ENGINES; ++e) {
+      if (!strcmp(opt, ENGINE_STRINGS[e])) { break; }
     }
 
-    int r = game_check_bottleneck(info, &state_copy);
-    if (r) {
-      printf("chokepoint for ");
-      for (size_t color=0; color<info->num_colors; ++color) {
-        if (r & (1 << color)) {
-          printf("%s", color_name_str(info, color));
-        }
-      }
-      printf(" -- state should be pruned!\n");
-      break;
+    if (e == NUM_ENGINES) {
+      fprintf(stderr, "unrecognized engine %s "
+              "on command line!\n\n", opt);
+      return 0;
     }
 
-    int color, dir;
-    forced = game_find_forced(info, &state_copy,
-                              &color, &dir);
+    g_options.search_engine = e;
     
-    if (forced) {
+  } else if (match_short_char == 'k') {
 
-      cell_t move = cell_create(TYPE_PATH, color, dir);
+    opt = get_argument(argc, argv, i);
+  
+    char* endptr;
+    g_options.search_max_paths = strtol(opt, &endptr, 10);
+  
+    if (!endptr || *endptr || !g_options.search_max_paths) {
+      fprintf(stderr, "error parsing max paths %s "
+              "on command line!\n\n", opt);
+      return 0;
+    }
 
-      printf("color %s is forced to move %s\n",
-             color_name_str(info, color),
-             color_cell_str(info, move));
+  } else if (match_short_char == 'J') {
 
-      if (!game_can_move(info, &state_copy, color, dir)) {
-        printf("...but it is not allowed -- state should be pruned!\n");
-        break;
-      }
+    g_options.cache_file = get_argument(argc, argv, i);
 
-      game_make_move(info, &state_copy, color, dir, 1);
-      
+  } else if (match_short_char == 'l') {
+
+    opt = get_argument(argc, argv, i);
+  
+    char* endptr;
+    g_options.search_count = strtol(opt, &endptr, 10);
+  
+    if (!endptr || *endptr || g_options.search_count < 1) {
+      fprintf(stderr, "error parsing solution count %s "
+              "on command line!\n\n", opt);
+      return 0;
+    }
+
+  } else if (match_short_char == 'z') {
+
+    opt = get_argument(argc, argv, i);
+    
+    char* endptr;
+    g_options.order_seed = strtoul(opt, &endptr, 10);
+    
+    if (!endptr || *endptr) {
+      fprintf(stderr, "error parsing seed %s "
+              "on command line!\n\n", opt);
+      return 0;
     }
     
-  }
+  } else if (match_short_char == 'y') {
+
+    opt = get_argument(argc, argv, i);
+    
+    char* endptr;
+    long restart_unit = strtol(opt, &endptr, 10);
+    
+    if (!endptr || *endptr || restart_unit <= 0) {
+      fprintf(stderr, "error parsing restart nodes %s "
+              "on command line!\n\n", opt);
+      return 0;
+    }
+
+    g_options.search_restart_unit = restart_unit;
+    
+  } else if (match_short_char == 'w') {
+
+    opt = get_argument(argc, argv, i);
+    
+    char* endptr;
+    g_options.search_weight = strtod(opt, &endptr);
+    
+    if (!endptr || *endptr || !(g_options.search_weight >= 1)) {
+      fprintf(stderr, "error parsing weight %s "
+              "on command line!\n\n", opt);
+      return 0;
+    }
+    
+  } else if (match_short_char == 'H') {
+
+    opt = get_argument(argc, argv, i);
   
-}
+    if (!exists(opt)) {
+      fprintf(stderr, "error opening %s\n", opt);
+      return 0;
+    }
+  
+    inputs->hint_files[inputs->num_hints].filename = opt;
+    inputs->hint_files[inputs->num_hints].weight = inputs->hint_weight;
+    inputs->hint_files[inputs->num_hints].input = inputs->num_inputs;
+    ++inputs->num_hints;
 
-tree_node_t* game_validate_ff(const game_info_t* info,
-                              tree_node_t* node,
-                              node_storage_t* storage) {
+  } else if (match_short_char == 'G') {
 
-  assert(node == storage->start+storage->count-1);
+    opt = get_argument(argc, argv, i);
+    
+    char* endptr;
+    inputs->hint_weight = strtod(opt, &endptr);
+    
+    if (!endptr || *endptr || !(inputs->hint_weight > 0)) {
+      fprintf(stderr, "error parsing hint weight %s "
+              "on command line!\n\n", opt);
+      return 0;
+    }
+
+  } else if (match_short_char == 'V') {
+
+    opt = get_argument(argc, argv, i);
   
-  const game_state_t* node_state = &node->state;
+    if (!exists(opt)) {
+      fprintf(stderr, "error opening %s\n", opt);
+      return 0;
+    }
+  
+    inputs->warm_files[inputs->num_inputs] = opt;
 
-  if (g_options.search_fast_forward &&
-      g_options.order_forced_first) {
+  } else if (match_short_char == 'o') {
 
-    int color, dir;
+    inputs->user_orders[inputs->num_inputs] = get_argument(argc, argv, i);
     
-    if (game_find_forced(info, node_state,
-                         &color, &dir)) {
+  } else if (match_short_char == 'h') {
 
-      if (!game_can_move(info, node_state, color, dir)) {
-        goto unalloc_return_0;
-      }
+    usage(stdout, 0);
+
+  } else if (match_short_char == 'j') {
+
+    g_options.serve_socket = get_argument(argc, argv, i);
+
+  } else { // should not happen
+
+    fprintf(stderr, "unrecognized option: %s\n", opt);
+    return 0;
+
+  }
+
+  return 1;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Parse command-line options
+
+size_t parse_options(int argc, char** argv,
+                     const char** input_files,
+                     const char** user_orders,
+                     hint_file_t* hint_files,
+                     const char** warm_files) {
+
+  inputs_t inputs = { input_files, user_orders, hint_files, warm_files,
+                      0, 0, 1 };
+
+  if (argc < 2) {
+    fprintf(stderr, "not enough args!\n\n");
+    usage(stderr, 1);
+  }
+
+  for (int i=1; i<argc; ++i) {
+    
+    const char* opt = argv[i];
+    int parsed = parse_option(argc, argv, &i, &inputs);
+
+    if (!parsed) {
+
+      exit(1);
+
+    } else if (parsed < 0 && exists(opt)) {
+
+      input_files[inputs.num_inputs++] = opt;
+
+    } else if (parsed < 0) {
+
+      fprintf(stderr, "unrecognized option: %s\n\n", opt);
+      usage(stderr, 1);
       
-      tree_node_t* forced_child = node_create(storage, node, info,
-                                              node_state);
+    }
+    
+  }
+
+  size_t num_inputs = inputs.num_inputs;
+  size_t num_hints = inputs.num_hints;
+
+  if (!num_inputs && !g_options.serve) {
+    fprintf(stderr, "no input files\n\n");
+    exit(1);
+  } else if (num_inputs && g_options.serve) {
+    fprintf(stderr, "--serve reads boards from requests, "
+            "not input files\n\n");
+    exit(1);
+  } else if (g_options.serve_socket && !g_options.serve) {
+    fprintf(stderr, "--socket only works with --serve\n\n");
+    exit(1);
+  } else if (user_orders[num_inputs]) {
+    fprintf(stderr, "order specified *after* last input file!\n\n");
+    exit(1);
+  } else if (num_hints && hint_files[num_hints-1].input == num_inputs) {
+    fprintf(stderr, "hint file specified *after* last input file!\n\n");
+    exit(1);
+  } else if (warm_files[num_inputs]) {
+    fprintf(stderr, "warm start specified *after* last input file!\n\n");
+    exit(1);
+  }
+
+  return num_inputs;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Set all options to their defaults, before parsing the command line.
+
+void options_set_defaults() {
+
+  g_options.display_quiet = 0;
+  g_options.display_diagnostics = 0;
+  g_options.display_animate = 1;
+  g_options.display_color = terminal_has_color();
+  g_options.display_fast = 0;
+  g_options.display_save_svg = 0;
+  
+  g_options.node_check_touch = 1;
+  g_options.node_check_stranded = 1;
+  g_options.node_check_deadends = 1;
+  g_options.node_check_matching = 1;
+  g_options.node_check_parity = 1;
+  g_options.node_check_distance = 1;
+  g_options.node_check_domains = 1;
+  g_options.node_bottleneck_limit = 3;
+  g_options.node_penalize_exploration = 0;
+  g_options.node_lazy_checks = 0;
+
+  g_options.order_autosort_colors = 1;
+  g_options.order_most_constrained = 1;
+  g_options.order_forced_first = 1;
+  g_options.order_seed = now() * 1e6;
+
+  g_options.search_outside_in = 1;
+  g_options.search_best_first = 1;
+  g_options.search_max_nodes = 0;
+  g_options.search_max_mb = 128;
+  g_options.search_fast_forward = 1;
+  g_options.search_partial_expansion = 0;
+  g_options.search_corridors = 1;
+  g_options.search_split = 1;
+  g_options.search_nogoods = 1;
+  g_options.search_symmetry = 1;
+  g_options.search_both_ends = 0;
+  g_options.search_threads = 1;
+  g_options.search_heuristic = HEURISTIC_FREE;
+  g_options.search_engine = ENGINE_SEARCH;
+  g_options.search_max_paths = 20000;
+  g_options.search_weight = 1;
+  g_options.search_anytime = 0;
+  g_options.search_restart_unit = 0;
+  g_options.search_count = 0;
+  g_options.cache_file = 0;
+
+  g_options.serve = 0;
+  g_options.serve_socket = 0;
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Query functions for programs that use the solver as a library
+// (compile with FLOW_SOLVER_LIBRARY defined to leave out main). They
+// work on game states owned by the caller, keep no state between
+// calls, and neither allocate memory nor print anything, so they
+// are cheap enough to call for every move of an interactive game.
+// Call query_setup once before any of them.
+
+void query_setup() {
+
+  options_set_defaults();
+
+  g_options.display_quiet = 1;
+  g_options.display_animate = 0;
+  g_options.display_color = 0;
+
+  // Splitting allocates a queue per subproblem and starts threads
+  g_options.search_split = 0;
+
+  queue_setup();
+  patterns_setup();
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Find a move that the given state forces. Returns 1 and sets
+// *color, *dir if there is one, 0 otherwise.
+
+int query_forced(const game_info_t* info,
+                 const game_state_t* state,
+                 int* color,
+                 int* dir) {
 
-      // if null, we ran out of memory and returning node is fine.
-      
-      if (forced_child) {
+  return game_find_forced(info, state, color, dir, 0);
 
-        game_make_move(info, &forced_child->state,
-                       color, dir, 1);
+}
 
-        node_update_costs(info, forced_child, 0);
-        forced_child = game_validate_ff(info, forced_child, storage);
-      
-        if (!forced_child) {
-          goto unalloc_return_0;
-        } else {
-          return forced_child;
-        }
+//////////////////////////////////////////////////////////////////////
+// Can the head of the given color move in the given direction?
 
-      }
-      
-    }
+int query_can_move(const game_info_t* info,
+                   const game_state_t* state,
+                   int color,
+                   int dir) {
 
+  if (color < 0 || color >= (int)info->num_colors ||
+      dir < 0 || dir >= 4) {
+    return 0;
   }
 
-  if (g_options.node_check_deadends &&
-      game_check_deadends(info, node_state)) {
-    goto unalloc_return_0;
+  return game_can_move(info, state, color, dir);
+
+}
+
+//////////////////////////////////////////////////////////////////////
+// Run the checks whose bits (1 << CHECK_DEADENDS, CHECK_STRANDED or
+// CHECK_BOTTLENECK) are set in checks on a state, ignoring the
+// options that turn them off in the search. The dead end and
+// bottleneck checks look around the head of state->last_color, so
+// that should be the color that moved last. Returns the bits of the
+// checks that show the state can't be solved, or 0 if none do.
+
+int query_check(const game_info_t* info,
+                const game_state_t* state,
+                int checks) {
+
+  int failed = 0;
+
+  if ((checks & (1 << CHECK_DEADENDS)) &&
+      game_check_deadends(info, state)) {
+    failed |= (1 << CHECK_DEADENDS);
   }
 
-  if (g_options.node_check_stranded) {
-    
+  if (checks & (1 << CHECK_STRANDED)) {
+
     uint8_t rmap[MAX_CELLS];
-    size_t rcount = game_build_regions(info, node_state, rmap);
-    
-    if (game_regions_stranded(info, node_state, rcount, rmap,
+    size_t rcount = game_build_regions(info, state, rmap);
+
+    if (game_regions_stranded(info, state, rcount, rmap,
                               MAX_COLORS, 1)) {
-      goto unalloc_return_0;
+      failed |= (1 << CHECK_STRANDED);
     }
 
   }
 
-  if (g_options.node_bottleneck_limit && 
-      game_check_bottleneck(info, node_state)) {
-
-    goto unalloc_return_0;
-    
+  if ((checks & (1 << CHECK_BOTTLENECK)) &&
+      game_check_bottleneck(info, state)) {
+    failed |= (1 << CHECK_BOTTLENECK);
   }
-  
-  return node;
 
- unalloc_return_0:
+  return failed;
 
-  assert(node == storage->start+storage->count-1);
-  node_storage_unalloc(storage, node);
-  return 0;
-  
 }
 
 //////////////////////////////////////////////////////////////////////
-// Peforms A* or BFS search
+// Search for a solution using at most max_nodes nodes from the
+// caller's nodes array, and max_nodes queue slots from the queue
+// array. On SEARCH_SUCCESS, *color and *dir are set to a move that
+// leads to the solution found, from the head of a color that isn't
+// complete yet (the last color moved if possible, so a player can
+// keep going with it). SEARCH_UNREACHABLE means the state can't be
+// solved (or is solved already), and SEARCH_FULL means the budget
+// ran out before the search could tell.
+
+int query_next_move(const game_info_t* info,
+                    const game_state_t* state,
+                    tree_node_t* nodes,
+                    tree_node_t** queue,
+                    size_t max_nodes,
+                    int* color,
+                    int* dir) {
+
+  if (state->completed == (1 << info->num_colors) - 1) {
+    // Already solved, so there is no next move
+    return SEARCH_UNREACHABLE;
+  }
 
-int game_search(const game_info_t* info,
-                const game_state_t* init_state,
-                const uint8_t* hint,
-                double* elapsed_out,
-                size_t* nodes_out,
-                game_state_t* final_state) {
+  node_storage_t storage;
 
-  size_t max_nodes = g_options.search_max_nodes;
+  storage.start = nodes;
+  storage.capacity = max_nodes;
+  storage.count = 0;
 
-  if (!max_nodes) {
-    max_nodes = floor( g_options.search_max_mb * MEGABYTE /
-                       sizeof(tree_node_t) );
+  queue_t q = queue_wrap(queue, max_nodes);
+
+  search_stats_t stats;
+  memset(&stats, 0, sizeof(stats));
+
+  const tree_node_t* solution_node = NULL;
+
+  int result = game_search_core(info, state, 0, &storage, &q,
+                                &stats, 0, &solution_node);
+
+  if (result != SEARCH_SUCCESS) {
+    return result;
   }
 
-  node_storage_t storage = node_storage_create(max_nodes);
+  const game_state_t* solution = &solution_node->state;
 
-  tree_node_t* root = node_create(&storage, NULL, info, init_state);
-  node_update_costs(info, root, 0);
+  // Path cells store the direction of the move into them, so the next
+  // move of a color goes to the free neighbor of its head that was
+  // entered going away from the head.
+  for (size_t i=0; i<=info->num_colors; ++i) {
 
-  if (!g_options.display_quiet) {
-    
-    printf("will search up to %'zu nodes (%'.2f MB)\n",
-           max_nodes, max_nodes*(double)sizeof(tree_node_t)/MEGABYTE);
-  
-    printf("heuristic at start is %'g\n\n",
-           root->cost_to_go);
+    size_t c = i ? info->color_order[i-1] : state->last_color;
 
-    game_print(info, init_state);
+    if (c >= info->num_colors || (state->completed & (1 << c))) {
+      continue;
+    }
+
+    for (int d=0; d<4; ++d) {
+
+      pos_t next_pos = pos_offset_pos(info, state->pos[c], d);
+
+      if (next_pos != INVALID_POS && state->cells[next_pos] == 0 &&
+          cell_get_color(solution->cells[next_pos]) == c &&
+          cell_get_direction(solution->cells[next_pos]) == d) {
+        *color = c;
+        *dir = d;
+        return SEARCH_SUCCESS;
+      }
+
+    }
 
   }
 
-  queue_t q = queue_create(max_nodes);
+  // Can't happen unless the search returned a broken solution
+  assert(0 && "solution has no next move");
+  return SEARCH_FULL;
 
-  int result = SEARCH_IN_PROGRESS;
-  const tree_node_t* solution_node = NULL;
+}
 
-  double start = now();
+#ifndef _WIN32
+
+//////////////////////////////////////////////////////////////////////
+// Skip over whitespace in JSON text.
 
-  root = game_validate_ff(info, root, &storage);
+const char* json_skip_space(const char* s) {
 
-  if (!root) {
-    result = SEARCH_UNREACHABLE;
-  } else {
-    queue_enqueue(&q, root);
+  while (*s && isspace((unsigned char)*s)) {
+    ++s;
   }
-  
-  while (result == SEARCH_IN_PROGRESS) {
 
-    if (queue_empty(&q)) {
-      result = SEARCH_UNREACHABLE;
-      break;
-    }
+  return s;
 
-    tree_node_t* n = queue_deque(&q);
-    assert(n);
+}
 
-    game_state_t* parent_state = &n->state;
+//////////////////////////////////////////////////////////////////////
+// Parse the JSON string starting at s into buf, which has room for
+// size bytes including the terminating zero (if buf is null, the
+// string is just skipped). Only ASCII \u escapes are supported.
+// Returns a pointer just past the closing quote, or null on error.
 
-    int color = game_next_move_color(info, parent_state);
-    int hint_dir = -1;
+const char* json_parse_string(const char* s, char* buf, size_t size) {
 
-    if (hint) {
-      pos_t pos = parent_state->pos[color];
-      if (hint[pos] == color || hint[pos] >= info->num_colors) {
-        for (int dir=0; dir<4; ++dir) {
-          pos_t neighbor_pos = pos_offset_pos(info, pos, dir);
-          if (neighbor_pos != INVALID_POS && 
-              parent_state->cells[neighbor_pos] == 0 &&
-              hint[neighbor_pos] == color) {
-            hint_dir = dir;
-            break;
-          }
+  if (*s != '"') { return 0; }
+  ++s;
+
+  size_t n = 0;
+
+  while (*s != '"') {
+
+    char c = *s++;
+
+    if (!c) {
+      return 0;
+    } else if (c == '\\') {
+
+      c = *s++;
+
+      switch (c) {
+      case '"': case '\\': case '/': break;
+      case 'b': c = '\b'; break;
+      case 'f': c = '\f'; break;
+      case 'n': c = '\n'; break;
+      case 'r': c = '\r'; break;
+      case 't': c = '\t'; break;
+      case 'u': {
+        unsigned code = 0;
+        for (int i=0; i<4; ++i, ++s) {
+          if (!isxdigit((unsigned char)*s)) { return 0; }
+          int h = tolower((unsigned char)*s);
+          code = 16*code + (isdigit(h) ? h - '0' : h - 'a' + 10);
         }
+        if (!code || code > 127) { return 0; }
+        c = code;
+        break;
+      }
+      default:
+        return 0;
       }
-    }
-      
-    for (int dir=0; dir<4; ++dir) {
 
-      if (hint_dir >= 0 && dir != hint_dir) { continue; }
+    }
 
-      int forced = 0;
+    if (buf) {
+      if (n+1 >= size) { return 0; }
+      buf[n++] = c;
+    }
 
-      if (g_options.order_forced_first && !g_options.search_fast_forward) {
-        forced = game_find_forced(info, &n->state, &color, &dir);
-      }
-     
-      if (game_can_move(info, &n->state,
-                        color, dir)) {
+  }
 
-        tree_node_t* child = node_create(&storage, n, info,
-                                         parent_state);
+  if (buf) { buf[n] = 0; }
 
-        if (!child) {
-          result = SEARCH_FULL;
-          break;
-          
-        }
+  return s+1;
 
-        size_t action_cost = game_make_move(info, &child->state,
-                                            color, dir, forced);
-        
-        node_update_costs(info, child, action_cost);
+}
 
-        child = game_validate_ff(info, child, &storage);
-        
-        if (child) {
+//////////////////////////////////////////////////////////////////////
+// Skip over any JSON value. Returns a pointer just past it, or null
+// if it isn't valid.
 
-          const game_state_t* child_state = &child->state;
-          
-          if ( child_state->num_free == 0 && 
-               child_state->completed == (1 << info->num_colors) - 1 ) {
-          
-            result = SEARCH_SUCCESS;
-            solution_node = child;
-          
-            break;
-      
-          }
-          
-          queue_enqueue(&q, child);
-        }
+const char* json_skip_value(const char* s) {
 
-      } // if can move
+  s = json_skip_space(s);
 
-      if (forced) { break; }
+  if (*s == '"') {
+    return json_parse_string(s, 0, 0);
+  }
 
-    } // for each dir
+  if (*s == '[' || *s == '{') {
 
-  } // while search active
+    char close = (*s == '[') ? ']' : '}';
 
-  double elapsed = now() - start;
-  if (elapsed_out) { *elapsed_out = elapsed; }
-  if (nodes_out)   { *nodes_out = storage.count; }
-  
+    s = json_skip_space(s+1);
+    if (*s == close) { return s+1; }
 
-  if (!g_options.display_quiet) {
-  
-    if (result == SEARCH_SUCCESS) {
-      assert(solution_node);
-      if (!g_options.display_animate) {
-        printf("\n");
-        game_print(info, &solution_node->state);
-      } else {
-        if (elapsed < 1.0) {
-          delay_seconds(1.0 - elapsed);
-        }
-        game_animate_solution(info, solution_node);
-        delay_seconds(1.0);
+    while (s) {
+      if (close == '}') {
+        s = json_parse_string(s, 0, 0);
+        if (!s) { return 0; }
+        s = json_skip_space(s);
+        if (*s++ != ':') { return 0; }
       }
-    } 
-
-    double storage_mb = (storage.count * (double)sizeof(tree_node_t) / MEGABYTE);
+      s = json_skip_value(s);
+      if (!s) { return 0; }
+      s = json_skip_space(s);
+      if (*s == close) { return s+1; }
+      if (*s++ != ',') { return 0; }
+      s = json_skip_space(s);
+    }
 
-    printf("\nsearch %s after %'.3f seconds and %'zu nodes (%'.2f MB)\n",
-           SEARCH_RESULT_STRINGS[result],
-           elapsed,
-           storage.count, storage_mb);
+    return 0;
 
-    if (result == SEARCH_SUCCESS) {
-    
-      assert(solution_node);
+  }
 
-      printf("final cost to come=%'g, cost to go=%'g\n",
-             solution_node->cost_to_come,
-             solution_node->cost_to_go);
+  // Numbers, true, false and null
+  const char* start = s;
 
-    } else if (result == SEARCH_FULL && g_options.display_diagnostics) {
+  while (isalnum((unsigned char)*s) || *s == '+' || *s == '-' || *s == '.') {
+    ++s;
+  }
 
-      printf("here's the lowest cost thing on the queue:\n");
+  return s > start ? s : 0;
 
-      game_diagnostics(info, queue_peek(&q));
+}
 
-      printf("\nand here's the last node allocated:\n");
+//////////////////////////////////////////////////////////////////////
+// Write a string to a JSON stream, with quotes and escapes.
 
-      game_diagnostics(info, storage.start+storage.count-1);
-      
-    }
+void json_print_string(FILE* fp, const char* s) {
 
-  }
+  fputc('"', fp);
 
-  if (final_state) {
-    if (result == SEARCH_SUCCESS) {
-      assert(solution_node);
-      *final_state = solution_node->state;
-    } else if (storage.count) {
-      *final_state = storage.start[storage.count-1].state;
+  for ( ; *s; ++s) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      fprintf(fp, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(fp, "\\u%04x", c);
     } else {
-      *final_state = *init_state;
+      fputc(c, fp);
     }
   }
 
-  node_storage_destroy(&storage);
-  queue_destroy(&q);
+  fputc('"', fp);
 
-  return result;
-  
 }
 
 //////////////////////////////////////////////////////////////////////
-// Command line usage
+// Parse one line of --serve input, which looks like
+//
+//   {"id": 7, "board": "R.G\n.B.\nRBG\n", "options": ["-w", "2"]}
+//
+// where id is optional and echoed back with the response, and the
+// options are the same as on the command line. Other keys are
+// ignored. Returns null on success, or a description of what's wrong.
 
-void usage(FILE* fp, int exitcode) {
+const char* serve_parse_request(const char* line, serve_request_t* req) {
 
-  fprintf(fp,
-          "usage: flow_solver [ OPTIONS ] [ -H HINT1.txt ] "
-          "[ -o ORDER1 ] BOARD1.txt\n"
-          "                   [ [ -H HINT2.txt ] [ -o ORDER2 ] "
-          "BOARD2.txt [ ... ] ]\n\n"
-          "Display options:\n\n"
-          "  -q, --quiet             Reduce output\n"
-          "  -D, --diagnostics       Print diagnostics when search unsuccessful\n"
-          "  -A, --no-animation      Disable animating solution\n"
-          "  -F, --fast              Speed up animation 4x\n"
-#ifndef _WIN32          
-          "  -C, --color             Force use of ANSI color\n"
-#endif
-          "  -S, --svg               Output final state to SVG\n"
-          "\n"
-          "Node evaluation options:\n\n"
-          "  -t, --touch             Disable path self-touch test\n"
-          "  -s, --stranded          Disable stranded checking\n"
-          "  -d, --deadends          Disable dead-end checking\n"
-          "  -b, --bottlenecks N     Set bottleneck limit check (default %d)\n"
-          "  -e, --no-explore        Penalize exploring away from walls\n"
-          "\n"
-          "Color ordering options:\n\n"
-          "  -a, --no-autosort       Disable auto-sort of color order\n"
-          "  -r, --randomize         Shuffle order of colors before solving\n"
-          "  -f, --forced            Disable ordering forced moved first\n"
-          "  -c, --constrained       Disable order by most constrained\n"
-          "\n"
-          "Search options:\n\n"
-          "  -O, --no-outside-in     Disable outside-in searching\n"
-          "  -B, --breadth-first     Breadth-first search instead of best-first\n"
-          "  -n, --max-nodes N       Restrict storage to N nodes\n"
-          "  -m, --max-storage N     Restrict storage to N MB (default %'g)\n"
-          "  -Q, --queue-always      Disable \"fast-forward\" queue bypassing\n"
-          "\n"
-          "Options affecting the next input file:\n\n"
-          "  -o, --order ORDER       Set color order on command line\n"
-          "  -H, --hint HINTFILE     Provide hint for previous board.\n"
-          "\n"
-          "Help:\n\n"
-          "  -h, --help              See this help text\n\n",
-          g_options.node_bottleneck_limit,
-          g_options.search_max_mb);
+  strcpy(req->id, "null");
+  req->board[0] = 0;
+  req->argv[0] = "flow_solver";
+  req->argc = 1;
+
+  size_t used = 0;
+
+  const char* s = json_skip_space(line);
+
+  if (*s != '{') {
+    return "request is not a JSON object";
+  }
+
+  s = json_skip_space(s+1);
+
+  while (*s != '}') {
+
+    char key[64];
+
+    s = json_parse_string(s, key, sizeof(key));
+    if (!s) { return "invalid JSON"; }
+
+    s = json_skip_space(s);
+    if (*s != ':') { return "invalid JSON"; }
+    s = json_skip_space(s+1);
+
+    if (!strcmp(key, "id")) {
+
+      const char* end = json_skip_value(s);
+
+      if (!end || *s == '[' || *s == '{' ||
+          (size_t)(end - s) >= sizeof(req->id)) {
+        return "id must be a string or number";
+      }
+
+      memcpy(req->id, s, end - s);
+      req->id[end - s] = 0;
+      s = end;
+
+    } else if (!strcmp(key, "board")) {
+
+      s = json_parse_string(s, req->board, sizeof(req->board));
+      if (!s) { return "board must be a string of up to 15 rows"; }
+
+    } else if (!strcmp(key, "options")) {
+
+      if (*s != '[') { return "options must be an array of strings"; }
+      s = json_skip_space(s+1);
+
+      while (*s != ']') {
+
+        if (req->argc == MAX_SERVE_OPTIONS) { return "too many options"; }
+
+        char* arg = req->options + used;
+
+        s = json_parse_string(s, arg, sizeof(req->options) - used);
+        if (!s) { return "options must be an array of strings"; }
 
-  exit(exitcode);
-  
-}
+        used += strlen(arg) + 1;
+        req->argv[req->argc++] = arg;
 
-//////////////////////////////////////////////////////////////////////
-// Check file exists
+        s = json_skip_space(s);
+        if (*s == ',') {
+          s = json_skip_space(s+1);
+        } else if (*s != ']') {
+          return "invalid JSON";
+        }
 
-int exists(const char* fn) {
+      }
+
+      ++s;
+
+    } else {
+
+      s = json_skip_value(s);
+      if (!s) { return "invalid JSON"; }
+
+    }
+
+    s = json_skip_space(s);
+
+    if (*s == ',') {
+      s = json_skip_space(s+1);
+    } else if (*s != '}') {
+      return "invalid JSON";
+    }
 
-  FILE* fp = fopen(fn, "r");
-  
-  if (fp) {
-    fclose(fp);
-    return 1;
-  } else {
-    return 0;
   }
 
+  if (!req->board[0]) {
+    return "request has no board";
+  }
+
+  return 0;
+
 }
 
 //////////////////////////////////////////////////////////////////////
-//
+// Answer one line of --serve input with one line of output, solving
+// the board with the server's options plus the request's. Searches
+// reuse the node storage and queue kept by search_memory_get.
 
-const char* get_argument(int argc, char** argv, int* i) {
+void serve_request(const char* line,
+                   FILE* out,
+                   const options_t* base,
+                   solution_cache_t* cache) {
 
-  assert(*i < argc);
-  
-  if ((*i)+1 == argc) {
-    fprintf(stderr, "%s needs argument\n", argv[*i]);
-    usage(stderr, 1);
+  serve_request_t req;
+  game_info_t info;
+  game_state_t state;
+
+  const char* error = serve_parse_request(line, &req);
+
+  g_options = *base;
+
+  for (int i=1; i<req.argc && !error; ++i) {
+    if (parse_option(req.argc, req.argv, &i, 0) <= 0) {
+      error = "invalid options";
+    }
   }
 
-  return argv[++(*i)];
-  
-  
-}
+  // Nothing else may be written to the output
+  g_options.display_quiet = 1;
+  g_options.display_animate = 0;
+  g_options.display_diagnostics = 0;
+  g_options.display_save_svg = 0;
 
-//////////////////////////////////////////////////////////////////////
-// Parse command-line options
+  queue_setup();
 
-size_t parse_options(int argc, char** argv,
-                     const char** input_files,
-                     const char** user_orders,
-                     const char** hint_files) {
-  
-  size_t num_inputs = 0;
+  if (g_options.node_check_touch != base->node_check_touch) {
+    patterns_setup();
+  }
+
+  if (!error) {
+
+    // Every row needs its newline, even the last
+    size_t l = strlen(req.board);
+    if (req.board[l-1] != '\n' && l+1 < sizeof(req.board)) {
+      req.board[l++] = '\n';
+      req.board[l] = 0;
+    }
+
+    FILE* fp = fmemopen(req.board, l, "r");
+
+    if (!fp || !game_read_fp(fp, "request", &info, &state)) {
+      error = "invalid board";
+    }
+
+    if (fp) { fclose(fp); }
 
-  if (argc < 2) {
-    fprintf(stderr, "not enough args!\n\n");
-    usage(stderr, 1);
   }
 
-  typedef struct flag_options_struct {
-    int short_char;
-    const char* long_string;
-    int* dst_flag;
-    int dst_value;
-  } flag_options_t;
+  if (error) {
 
-  flag_options_t options[] = {
-    { 'q', "quiet",         &g_options.display_quiet, 1 },
-    { 'D', "diagnostics",   &g_options.display_diagnostics, 1 },
-    { 'A', "animation",     &g_options.display_animate, 0 },
-#ifndef _WIN32    
-    { 'C', "color",         &g_options.display_color, 1 },
-#endif
-    { 'F', "fast",          &g_options.display_fast, 1 },
-    { 'S', "svg",           &g_options.display_save_svg, 1 },
-    { 't', "touch",         &g_options.node_check_touch, 0 },
-    { 's', "stranded",      &g_options.node_check_stranded, 0 },
-    { 'd', "deadends",      &g_options.node_check_deadends, 0 },
-    { 'b', "bottlenecks",   0, 0 },
-    { 'e', "no-explore",    &g_options.node_penalize_exploration, 1 },
-    { 'a', "no-autosort",   &g_options.order_autosort_colors, 0 },
-    { 'o', "order",         0, 0 },
-    { 'r', "randomize",     &g_options.order_random, 1 },
-    { 'f', "forced",        &g_options.order_forced_first, 0 },
-    { 'c', "constrained",   &g_options.order_most_constrained, 0 },
-    { 'O', "no-outside-in", &g_options.search_outside_in, 0 },
-    { 'B', "breadth-first", &g_options.search_best_first, 0 },
-    { 'Q', "queue-always",  &g_options.search_fast_forward, 0 },
-    { 'n', "max-nodes",     0, 0 },
-    { 'm', "max-storage",   0, 0 },
-    { 'H', "hint",          0, 0 },
-    { 'h', "help",          0, 0 },
-    { 0, 0, 0, 0 }
-  };
+    fprintf(out, "{\"id\":%s,\"status\":\"error\",\"error\":", req.id);
+    json_print_string(out, error);
+    fprintf(out, "}\n");
 
-  for (int i=1; i<argc; ++i) {
-    
-    const char* opt = argv[i];
-    int match_id = -1;
+  } else {
+
+    game_order_colors(&info, &state, 0);
+
+    double start = now();
+    double elapsed;
+    size_t nodes;
+    search_stats_t stats;
+    game_state_t final_state;
+    int result;
+
+    // A cached solution says nothing about how many there are
+    if (!g_options.search_count &&
+        cache_lookup(cache, &info, &state, &final_state)) {
+      result = SEARCH_SUCCESS;
+      elapsed = now() - start;
+      nodes = 0;
+      memset(&stats, 0, sizeof(stats));
+    } else {
+      result = game_search(&info, &state, 0, &elapsed, &nodes,
+                           &stats, &final_state);
+      if (result == SEARCH_SUCCESS) {
+        cache_store(cache, &info, &state, &final_state);
+      }
+    }
 
-    for (int k=0; options[k].short_char; ++k) {
+    fprintf(out, "{\"id\":%s,\"status\":\"%s\",\"elapsed\":%.6f,"
+            "\"nodes\":%zu", req.id, SEARCH_RESULT_STRINGS[result],
+            elapsed, nodes);
 
-      if (options[k].short_char > 0) {
-        char cur_short[3] = "-?";
-        cur_short[1] = options[k].short_char;
-        if (!strcmp(opt, cur_short)) {
-          match_id = k;
-          break;
+    if (g_options.search_count) {
+      fprintf(out, ",\"solutions\":%zu,\"exact\":%s",
+              stats.solutions, stats.solutions_exact ? "true" : "false");
+    }
+
+    if (result == SEARCH_SUCCESS) {
+
+      // Answer in the letters the request used
+      char color_chars[MAX_COLORS];
+
+      for (int c=0; c<128; ++c) {
+        if (info.color_tbl[c] < info.num_colors) {
+          color_chars[info.color_tbl[c]] = c;
         }
       }
 
-      if (options[k].long_string) {
-        char cur_long[1024];
-        snprintf(cur_long, 1024, "--%s", options[k].long_string);
-        if (!strcmp(opt, cur_long)) {
-          match_id = k;
-          break;
+      fprintf(out, ",\"solution\":[");
+
+      for (size_t y=0; y<info.size; ++y) {
+        fprintf(out, "%s\"", y ? "," : "");
+        for (size_t x=0; x<info.size; ++x) {
+          cell_t cell = final_state.cells[pos_from_coords(x, y)];
+          fputc(color_chars[cell_get_color(cell)], out);
         }
+        fputc('"', out);
       }
 
-    }
+      fprintf(out, "]");
 
-    if (match_id >= 0) {
+    }
 
-      int match_short_char = options[match_id].short_char;
+    fprintf(out, "}\n");
 
-      if (options[match_id].dst_flag) {
-        
-        *options[match_id].dst_flag = options[match_id].dst_value;
+  }
 
-      } else if (match_short_char == 'b') {
-                
-        opt = get_argument(argc, argv, &i);
-      
-        char* endptr;
-        g_options.node_bottleneck_limit = strtol(opt, &endptr, 10);
-      
-        if (!endptr || *endptr) {
-          fprintf(stderr, "error parsing bottleneck limit %s "
-                  "on command line!\n\n", opt);
-          exit(1);
-        }
+  fflush(out);
 
-      } else if (match_short_char == 'n') {
+  if (g_options.node_check_touch != base->node_check_touch) {
+    g_options.node_check_touch = base->node_check_touch;
+    patterns_setup();
+  }
 
-        opt = get_argument(argc, argv, &i);
-      
-        char* endptr;
-        g_options.search_max_nodes = strtol(opt, &endptr, 10);
-      
-        if (!endptr || *endptr) {
-          fprintf(stderr, "error parsing max nodes %s "
-                  "on command line!\n\n", opt);
-          exit(1);
-        }
+}
 
-      } else if (match_short_char == 'm') {
+//////////////////////////////////////////////////////////////////////
+// Answer requests from a stream, one per line, until it ends.
 
-        opt = get_argument(argc, argv, &i);
-        
-        char* endptr;
-        g_options.search_max_mb = strtod(opt, &endptr);
-        
-        if (!endptr || *endptr || g_options.search_max_mb <= 0) {
-          fprintf(stderr, "error parsing max storage %s "
-                  "on command line!\n\n", opt);
-          exit(1);
-        }
-        
-      } else if (match_short_char == 'H') {
+void serve_stream(FILE* in,
+                  FILE* out,
+                  const options_t* base,
+                  solution_cache_t* cache) {
 
-        opt = get_argument(argc, argv, &i);
-      
-        if (!exists(opt)) {
-          fprintf(stderr, "error opening %s\n", opt);
-          exit(1);
-        }
-      
-        hint_files[num_inputs] = opt;
+  char* line = 0;
+  size_t capacity = 0;
 
-      } else if (match_short_char == 'o') {
+  while (getline(&line, &capacity, in) >= 0) {
+    if (*json_skip_space(line)) {
+      serve_request(line, out, base, cache);
+    }
+  }
 
-        user_orders[num_inputs] = get_argument(argc, argv, &i);
-        
-      } else if (match_short_char == 'h') {
+  free(line);
 
-        usage(stdout, 0);
+}
 
-      } else { // should not happen
+//////////////////////////////////////////////////////////////////////
+// Run as a server (--serve), answering requests from stdin, or from
+// connections to a Unix socket (one at a time) if --socket was
+// given. Returns the exit code for the program.
 
-        fprintf(stderr, "unrecognized option: %s\n\n", opt);
-        usage(stderr, 1);
+int serve(solution_cache_t* cache) {
 
-      }
+  options_t base = g_options;
 
-    } else if (exists(opt)) {
+  // JSON numbers need a decimal point, whatever the locale
+  setlocale(LC_NUMERIC, "C");
 
-      input_files[num_inputs++] = opt;
+  if (!g_options.serve_socket) {
 
-    } else {
+    // Keep stdout for responses, and send anything else to stderr
+    FILE* out = fdopen(dup(STDOUT_FILENO), "w");
 
-      fprintf(stderr, "unrecognized option: %s\n\n", opt);
-      usage(stderr, 1);
-      
+    if (!out || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+      fprintf(stderr, "error setting up output for --serve\n");
+      return 1;
     }
-    
+
+    serve_stream(stdin, out, &base, cache);
+    fclose(out);
+
+    return 0;
+
   }
 
-  if (!num_inputs) {
-    fprintf(stderr, "no input files\n\n");
-    exit(1);
-  } else if (user_orders[num_inputs]) {
-    fprintf(stderr, "order specified *after* last input file!\n\n");
-    exit(1);
-  } else if (hint_files[num_inputs]) {
-    fprintf(stderr, "hint file specified *after* last input file!\n\n");
-    exit(1);
+  const char* path = g_options.serve_socket;
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "socket path %s is too long\n", path);
+    return 1;
   }
 
-  return num_inputs;
+  strcpy(addr.sun_path, path);
+
+  // Replace a socket left behind by an earlier server, but nothing else
+  struct stat st;
+  if (!stat(path, &st) && S_ISSOCK(st.st_mode)) {
+    unlink(path);
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (fd < 0 ||
+      bind(fd, (const struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      listen(fd, 16) < 0) {
+    fprintf(stderr, "error listening on %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+
+  // A client hanging up early shouldn't end the server
+  signal(SIGPIPE, SIG_IGN);
+
+  while (1) {
+
+    int conn = accept(fd, 0, 0);
+
+    if (conn < 0) {
+      if (errno == EINTR) { continue; }
+      fprintf(stderr, "error accepting on %s: %s\n", path, strerror(errno));
+      break;
+    }
+
+    FILE* in = fdopen(conn, "r");
+    FILE* out = fdopen(dup(conn), "w");
+
+    if (in && out) {
+      serve_stream(in, out, &base, cache);
+    }
+
+    if (in) { fclose(in); } else { close(conn); }
+    if (out) { fclose(out); }
+
+  }
+
+  close(fd);
+  unlink(path);
+
+  return 1;
 
 }
 
+#endif
+
+#ifndef FLOW_SOLVER_LIBRARY
+
 //////////////////////////////////////////////////////////////////////
 // Main function
 
@@ -2829,47 +9811,54 @@ int main(int argc, char** argv) {
 
   setlocale(LC_NUMERIC, "");
 
-  g_options.display_quiet = 0;
-  g_options.display_diagnostics = 0;
-  g_options.display_animate = 1;
-  g_options.display_color = terminal_has_color();
-  g_options.display_fast = 0;
-  g_options.display_save_svg = 0;
-  
-  g_options.node_check_touch = 1;
-  g_options.node_check_stranded = 1;
-  g_options.node_check_deadends = 1;
-  g_options.node_bottleneck_limit = 3;
-  g_options.node_penalize_exploration = 0;
-
-  g_options.order_autosort_colors = 1;
-  g_options.order_most_constrained = 1;
-  g_options.order_forced_first = 1;
-
-  g_options.search_outside_in = 1;
-  g_options.search_best_first = 1;
-  g_options.search_max_nodes = 0;
-  g_options.search_max_mb = 128;
-  g_options.search_fast_forward = 1;
+  options_set_defaults();
 
   const char* input_files[argc];
   const char* user_orders[argc];
-  const char* hint_files[argc];
+  hint_file_t hint_files[argc];
+  const char* warm_files[argc];
 
   memset(input_files, 0, sizeof(input_files));
   memset(user_orders, 0, sizeof(user_orders));
   memset(hint_files,  0, sizeof(hint_files));
+  memset(warm_files,  0, sizeof(warm_files));
   
   size_t num_inputs = parse_options(argc, argv,
                                     input_files,
                                     user_orders,
-                                    hint_files);
+                                    hint_files,
+                                    warm_files);
 
   queue_setup();
+  patterns_setup();
+
+  solution_cache_t cache;
+  memset(&cache, 0, sizeof(cache));
+
+  if (g_options.cache_file) {
+    cache_open(&cache, g_options.cache_file);
+  }
+
+#ifndef _WIN32
+  if (g_options.serve) {
+    int rval = serve(&cache);
+    cache_close(&cache);
+    search_memory_free();
+    return rval;
+  }
+#endif
+
+  // Non-quiet output logs the seed along with the color order
+  if (g_options.display_quiet &&
+      (g_options.order_random || g_options.search_restart_unit)) {
+    printf("using seed %u\n", g_options.order_seed);
+  }
 
   game_info_t  info;
   game_state_t state;
-  pos_t hint[MAX_CELLS];
+  hint_t hint;
+  pos_t hint_cells[MAX_CELLS];
+  pos_t warm[MAX_CELLS];
   
   int max_width = 11;
 
@@ -2886,7 +9875,7 @@ int main(int argc, char** argv) {
   for (size_t i=0; i<num_inputs; ++i) {
 
     const char* input_file = input_files[i];
-    const char* hint_file = hint_files[i];
+    const char* warm_file = warm_files[i];
     const char* user_order = user_orders[i];
   
     if (game_read(input_file, &info, &state)) {
@@ -2896,17 +9885,39 @@ int main(int argc, char** argv) {
                "***********************************\n\n");
       }
 
-      if (hint_file) {
-        if (!game_read_hint(&info, &state, hint_file, hint)) {
-          hint_file = 0;
-        } 
-      }
-      
       if (!g_options.display_quiet) {
         printf("read %zux%zu board with %zu colors from %s\n",
                info.size, info.size, info.num_colors, input_file);
-        if (hint_file) {
-          printf("read hint file from %s\n", hint_file);
+      }
+
+      size_t num_hints = 0;
+      memset(&hint, 0, sizeof(hint));
+
+      for (size_t h=0; hint_files[h].filename; ++h) {
+        if (hint_files[h].input == i &&
+            game_read_hint(&info, &state, hint_files[h].filename,
+                           hint_cells)) {
+          hint_add(&info, &hint, hint_cells, hint_files[h].weight);
+          ++num_hints;
+          if (!g_options.display_quiet) {
+            printf("read hint file from %s (weight %g)\n",
+                   hint_files[h].filename, hint_files[h].weight);
+          }
+        }
+      }
+
+      // Fixing paths changes the count, and only search can take it
+      if (warm_file) {
+        if (g_options.search_engine != ENGINE_SEARCH ||
+            g_options.search_count ||
+            !game_read_hint(&info, &state, warm_file, warm)) {
+          warm_file = 0;
+        }
+      }
+      
+      if (!g_options.display_quiet) {
+        if (warm_file) {
+          printf("read previous solution from %s\n", warm_file);
         }
         printf("\n");
       }
@@ -2915,6 +9926,7 @@ int main(int argc, char** argv) {
 
       double elapsed;
       size_t nodes;
+      search_stats_t stats;
       game_state_t final_state;
 
       if (g_options.display_quiet) { 
@@ -2922,8 +9934,41 @@ int main(int argc, char** argv) {
         fflush(stdout);
       }
 
-      int result = game_search(&info, &state, hint_file ? hint : 0,
-                               &elapsed, &nodes, &final_state);
+      double start = now();
+      int result;
+
+      // A cached solution says nothing about how many there are
+      if (!g_options.search_count &&
+          cache_lookup(&cache, &info, &state, &final_state)) {
+
+        result = SEARCH_SUCCESS;
+        elapsed = now() - start;
+        nodes = 0;
+        memset(&stats, 0, sizeof(stats));
+
+        if (!g_options.display_quiet) {
+          game_print(&info, &state);
+          printf("\n");
+          game_print(&info, &final_state);
+          printf("\nsearch %s after %'.6f seconds from solution cache\n",
+                 SEARCH_RESULT_STRINGS[result], elapsed);
+        }
+
+      } else {
+
+        if (warm_file) {
+          result = game_search_warm(&info, &state, warm,
+                                    &elapsed, &nodes, &stats, &final_state);
+        } else {
+          result = game_search(&info, &state, num_hints ? &hint : 0,
+                               &elapsed, &nodes, &stats, &final_state);
+        }
+
+        if (result == SEARCH_SUCCESS) {
+          cache_store(&cache, &info, &state, &final_state);
+        }
+
+      }
 
       assert( result >= 0 && result < 3 );
 
@@ -2933,10 +9978,24 @@ int main(int argc, char** argv) {
 
       if (g_options.display_quiet) {
         
-        printf("%c %'12.3f %'12zu\n",
+        printf("%c %'12.3f %'12zu",
                SEARCH_RESULT_CHARS[result],
                elapsed, nodes);
 
+        if (g_options.search_count) {
+          printf(" %'6zu%s", stats.solutions,
+                 stats.solutions_exact ? "" : "+");
+        }
+
+        printf("\n");
+
+        for (size_t i=0; i<stats.num_rounds; ++i) {
+          const search_round_t* round = stats.rounds + i;
+          printf("%*s w=%-6g %'12.3f %'12zu cost %g\n",
+                 max_width-7, "", round->weight,
+                 round->elapsed, round->nodes, round->cost);
+        }
+
       }
 
       if (g_options.display_save_svg) {
@@ -2977,7 +10036,7 @@ int main(int argc, char** argv) {
     for (int i=0; i<3; ++i) {
       overall_elapsed += total_elapsed[i];
       overall_nodes += total_nodes[i];
-      if (total_nodes[i]) { ++types; }
+      if (total_count[i]) { ++types; }
     }
 
     if (!g_options.display_quiet) {
@@ -3026,7 +10085,12 @@ int main(int argc, char** argv) {
     }
     
   }  
+
+  cache_close(&cache);
+  search_memory_free();
     
   return 0;
   
 }
+
+#endif